@@ -26,20 +26,185 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef H_OPTIC_MATCH
 #define H_OPTIC_MATCH
 
+#include <cstdint>
 #include <optmatch/prims.h>
 #include <optmatch/generator.h>
 
 namespace OpticMatch {
 
+// Counters accumulated by a classifier since creation or the last reset_stats
+struct ClassifierStats
+{
+  unsigned long queries;            // Glyphs classified
+  unsigned long templates_matched;  // Templates compared with the full perimeter match
+  unsigned long templates_pruned;   // Templates skipped by the descriptor prefilter
+  unsigned long templates_bounded;  // Templates skipped by their interleaved lower bound
+  unsigned long templates_reversed; // Lazy classify candidates matched on the query's planes
+  unsigned long templates_coarse;   // Templates matched on a quarter of the query's points
+  unsigned long prefilter_checked;  // Queries also classified without the prefilter
+  unsigned long prefilter_changed;  // Checked queries where the prefilter changed the result
+  unsigned long index_searches;     // Queries classified through the vantage point tree
+  unsigned long index_visited;      // Tree nodes compared by those queries, not the bounded scan after them
+  unsigned long cache_hits;         // Queries answered from the result cache
+  unsigned long cache_misses;       // Queries looked up and not found in the result cache
+  unsigned long cache_evictions;    // Cached results replaced, stale generations included
+
+  // Model size, not reset.  Training samples normalizing to an existing
+  // template of their class only count towards training_samples, so
+  // training_samples / templates is the deduplication ratio.
+  unsigned long templates;
+  unsigned long training_samples;
+
+  // Distance matrices built by both transforms under transform="check",
+  // counted over the whole process and not reset.  edt_exact_worse is 0
+  // unless the exact transform is broken.
+  unsigned long edt_matrices;       // Matrices built by both algorithms
+  unsigned long edt_cells;          // Cells compared
+  unsigned long edt_differing;      // Cells where the two distances differ
+  unsigned long edt_exact_worse;    // Cells where the exact distance is larger
+
+  ClassifierStats()
+    : queries(0), templates_matched(0), templates_pruned(0), templates_bounded(0), templates_reversed(0)
+    , templates_coarse(0)
+    , prefilter_checked(0), prefilter_changed(0), index_searches(0), index_visited(0)
+    , cache_hits(0), cache_misses(0), cache_evictions(0)
+    , templates(0), training_samples(0)
+    , edt_matrices(0), edt_cells(0), edt_differing(0), edt_exact_worse(0)
+  {}
+};
+
+// One alternative of classify_topk
+struct ClassScore
+{
+  wchar_t  ch;
+  double   score;     // Confidence, as returned by classify
+  unsigned distance;  // Match distance of the class's best template
+};
+
+// Result of CharClassifier::train
+struct TrainStats
+{
+  size_t samples;           // Images taken from the generator
+  size_t templates_added;   // Samples not duplicating a template of their class
+  double generate_seconds;  // Spent in the generator, overlapping the building
+  double build_seconds;     // Normalizing and building perimeters on the workers
+  double merge_seconds;     // Adding the built samples to the model
+  double total_seconds;
+
+  TrainStats()
+    : samples(0), templates_added(0)
+    , generate_seconds(0), build_seconds(0), merge_seconds(0), total_seconds(0)
+  {}
+};
+
+// Result of CharClassifier::condense
+struct CondenseStats
+{
+  size_t templates_before;
+  size_t templates_after;
+  double loo_accuracy_before;  // Leave-one-out accuracy of the training samples
+  double loo_accuracy_after;   // The same, against the kept prototypes
+};
+
+// Scratch buffers for classification, reused across calls so that steady
+// state classification does not allocate.  Use one context per thread.
+class ClassifyContext
+{
+public:
+  virtual ~ClassifyContext() {}
+};
+
 class CharClassifier
 {
 public:
   virtual ~CharClassifier() {}
   
+  // A threads argument of 0 below means the threads attribute of the
+  // create params, whose default of 0 means one worker per core.
+
+  // Training, condense and load build a new model and publish it at once.
+  // They may run while other threads classify, which keep using the model
+  // they started with and never wait for the writer.  Writers wait for each
+  // other.  With vptree, the update that adds more than an eighth of the
+  // indexed templates rebuilds the tree in O(n log n) template distances
+  // while other writers wait, so add samples in batches.
   virtual bool add_training_sample(const cv::Mat& image, wchar_t c) = 0;
-  virtual bool train(CharImageGenerator& cig) = 0;
+  // Adds count samples as one update, building them on threads workers.
+  // Returns the number of samples that became new templates.
+  virtual size_t add_training_samples(const cv::Mat* images, const wchar_t* chars, size_t count,
+                                      unsigned threads=0) = 0;
+  // Adds all samples of cig, building them on threads workers while the
+  // generator runs.  The model is the same as adding the samples one by one
+  // in generator order.  Returns false if cig had no samples.
+  virtual bool train(CharImageGenerator& cig, TrainStats* stats=nullptr, unsigned threads=0) = 0;
+  // The classify calls take 8 bit grayscale images and throw
+  // invalid_parameters_exception for empty images or other types.
   virtual wchar_t classify(const cv::Mat& image, double* conf=nullptr) const = 0;
+
+  // Offline reduction of the trained templates to a set of prototypes per
+  // class.  Keeps the leave-one-out accuracy of the training samples within
+  // tolerance (a fraction, e.g. 0.01) of what the full set achieves.
+  virtual CondenseStats condense(double tolerance=0, unsigned threads=0) = 0;
+
+  // Same as classify, using the buffers of ctx, which must come from
+  // create_context of this classifier.  The other classify calls use a
+  // context owned by the calling thread.
+  virtual std::shared_ptr<ClassifyContext> create_context() const = 0;
+  virtual wchar_t classify(const cv::Mat& image, ClassifyContext& ctx, double* conf=nullptr) const = 0;
+
+  // Classifies the roi of an 8 bit grayscale buffer whose rows are stride
+  // bytes apart, reading the pixels in place.  Same as classify of the roi
+  // of a cv::Mat over the buffer.
+  virtual wchar_t classify(const uint8_t* data, int stride, const cv::Rect& roi,
+                           double* conf=nullptr) const = 0;
+  virtual wchar_t classify(const uint8_t* data, int stride, const cv::Rect& roi,
+                           ClassifyContext& ctx, double* conf=nullptr) const = 0;
+
+  // Writes the up to k best classes, each scored by its best template, to
+  // out[0..k) ordered best first and returns how many were written.
+  // classify_topk and classify_scores compare every template that passes
+  // the prefilters, whatever the speed options, so their results are
+  // exact.  out[0] is the class classify returns, unless classify is
+  // approximate through lazy_candidates, coarse_margin or vptree_budget,
+  // when the two can differ.
+  virtual size_t classify_topk(const cv::Mat& image, size_t k, ClassScore* out) const = 0;
+
+  // Writes the score of each class to per_class, in the order of
+  // class_char, and if chars is not null the class itself to chars, for at
+  // most capacity classes.  Returns how many were written.  Classes skipped
+  // by the prefilter score 0.  Each call sees the model published when it
+  // starts, so a concurrent writer can add classes between calls; chars
+  // always match the scores of the same call.
+  virtual size_t classify_scores(const cv::Mat& image, float* per_class, size_t capacity,
+                                 wchar_t* chars=nullptr) const = 0;
+  virtual size_t class_count() const = 0;
+  // Throws invalid_parameters_exception if index is not below class_count()
+  virtual wchar_t class_char(size_t index) const = 0;
+
+  // Classifies count images, writing results to chars[i] and, if not null, confs[i].
+  // Work is spread over threads workers.
+  virtual void classify_batch(const cv::Mat* images, size_t count,
+                              wchar_t* chars, double* confs=nullptr,
+                              unsigned threads=0) const = 0;
+  // Same, for count rois of one buffer
+  virtual void classify_batch(const uint8_t* data, int stride, const cv::Rect* rois, size_t count,
+                              wchar_t* chars, double* confs=nullptr,
+                              unsigned threads=0) const = 0;
   
+  // Trained model persistence.  load memory maps the file and uses the
+  // stored matrices in place, so processes loading the same file share it.
+  virtual void save(const std::string& path) const = 0;
+  virtual void load(const std::string& path) = 0;
+
+  virtual ClassifierStats get_stats() const = 0;
+  virtual void reset_stats() = 0;
+
+  // params is empty for the defaults or a <classifier .../> element
+  // selecting the grid size, engine and match settings, see README.md.
+  // Throws invalid_parameters_exception for unknown names and for numbers
+  // that are malformed, negative or out of range.  vptree only makes
+  // classify sub-linear with a nonzero vptree_budget: with the default of 0
+  // the tree bounds an exact scan that still visits every template.
   static std::shared_ptr<CharClassifier> create(const std::string& params); 
 };
 
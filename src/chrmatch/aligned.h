@@ -0,0 +1,116 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+#ifndef H_ALIGNED_OPTMATCH
+#define H_ALIGNED_OPTMATCH
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+namespace OpticMatch {
+
+  const size_t CACHE_LINE = 64;
+
+  inline void* aligned_allocate(size_t size, size_t alignment = CACHE_LINE)
+  {
+    if (size == 0) return nullptr;
+#ifdef _MSC_VER
+    void* p = _aligned_malloc(size, alignment);
+#else
+    void* p = nullptr;
+    if (posix_memalign(&p, alignment, size) != 0) p = nullptr;
+#endif
+    if (!p) throw std::bad_alloc();
+    return p;
+  }
+
+  inline void aligned_release(void* p)
+  {
+#ifdef _MSC_VER
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+  }
+
+  inline size_t align_up(size_t n, size_t alignment = CACHE_LINE)
+  {
+    return (n + alignment - 1) & ~(alignment - 1);
+  }
+
+  // Owning, cache line aligned byte buffer with value semantics
+  class AlignedBuffer
+  {
+    unsigned char* m_Data;
+    size_t         m_Size;
+  public:
+    explicit AlignedBuffer(size_t size = 0)
+      : m_Data(static_cast<unsigned char*>(aligned_allocate(size)))
+      , m_Size(size)
+    {}
+
+    AlignedBuffer(const AlignedBuffer& o)
+      : m_Data(static_cast<unsigned char*>(aligned_allocate(o.m_Size)))
+      , m_Size(o.m_Size)
+    {
+      if (m_Size) memcpy(m_Data, o.m_Data, m_Size);
+    }
+
+    AlignedBuffer(AlignedBuffer&& o)
+      : m_Data(o.m_Data)
+      , m_Size(o.m_Size)
+    {
+      o.m_Data = nullptr;
+      o.m_Size = 0;
+    }
+
+    ~AlignedBuffer() { aligned_release(m_Data); }
+
+    AlignedBuffer& operator= (AlignedBuffer o)
+    {
+      swap(o);
+      return *this;
+    }
+
+    void swap(AlignedBuffer& o)
+    {
+      std::swap(m_Data, o.m_Data);
+      std::swap(m_Size, o.m_Size);
+    }
+
+    unsigned char*       data()       { return m_Data; }
+    const unsigned char* data() const { return m_Data; }
+    size_t size() const { return m_Size; }
+    bool empty() const { return m_Size == 0; }
+  };
+
+} // namespace OpticMatch
+
+#endif // H_ALIGNED_OPTMATCH
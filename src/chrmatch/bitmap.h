@@ -0,0 +1,244 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+#ifndef H_BITMAP_OPTMATCH
+#define H_BITMAP_OPTMATCH
+
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+#include <opencv2/opencv.hpp>
+#include "kernels.h"
+
+namespace OpticMatch {
+
+  // The functions below read 8 bit grayscale pixels straight from a buffer
+  // whose rows are stride bytes apart, so glyphs can be taken from any
+  // page buffer without wrapping them in a cv::Mat.  Their cv::Mat
+  // overloads cover the whole image.
+
+  // Packs an n x n binary (0 / 255) glyph at data into n words, bit x of
+  // word y set for black pixels.  n is at most 32.
+  inline void pack_glyph(const unsigned char* data, size_t stride, int n, uint32_t* rows)
+  {
+    for (int y = 0; y < n; ++y)
+    {
+      const unsigned char* row = data + y * stride;
+      uint32_t bits = 0;
+      for (int x = 0; x < n; ++x)
+        bits |= uint32_t(row[x] == 0) << x;
+      rows[y] = bits;
+    }
+  }
+
+  inline void pack_glyph(const cv::Mat& image, int n, uint32_t* rows)
+  {
+    pack_glyph(image.data, image.step, n, rows);
+  }
+
+  // Index of the first byte in [begin,end) of row that is not 255, or end.
+  // Whole words are tested eight bytes at a time.
+  inline int find_ink(const unsigned char* row, int begin, int end)
+  {
+    int x = begin;
+    for (; x + 8 <= end; x += 8)
+    {
+      uint64_t word;
+      memcpy(&word, row + x, 8);
+      if (word != ~uint64_t(0)) break;
+    }
+    for (; x < end; ++x)
+      if (row[x] != 255) return x;
+    return end;
+  }
+
+  // Index of the last byte in [begin,end) of row that is not 255, or begin - 1
+  inline int find_ink_back(const unsigned char* row, int begin, int end)
+  {
+    int x = end;
+    for (; x - 8 >= begin; x -= 8)
+    {
+      uint64_t word;
+      memcpy(&word, row + x - 8, 8);
+      if (word != ~uint64_t(0)) break;
+    }
+    for (--x; x >= begin; --x)
+      if (row[x] != 255) return x;
+    return begin - 1;
+  }
+
+  // Bounding box of the pixels in area that are not white, area itself if
+  // there are none.  The top and bottom rows are found scanning inwards,
+  // then each row in between only needs to be scanned outside of the
+  // columns already known to hold ink.
+  inline cv::Rect glyph_bounds(const unsigned char* data, size_t stride, const cv::Rect& area)
+  {
+    const unsigned char* base = data + area.y * stride + area.x;
+    int w = area.width, h = area.height;
+    int t = 0, b = h;
+    while (t < h && find_ink(base + t * stride, 0, w) == w) ++t;
+    if (t == h) return area;
+    while (find_ink(base + (b - 1) * stride, 0, w) == w) --b;
+    int l = w, r = 0;
+    for (int y = t; y < b; ++y)
+    {
+      const unsigned char* row = base + y * stride;
+      l = find_ink(row, 0, l);
+      r = find_ink_back(row, r, w) + 1;
+    }
+    return cv::Rect(area.x + l, area.y + t, r - l, b - t);
+  }
+
+  inline cv::Rect glyph_bounds(const cv::Mat& image)
+  {
+    return glyph_bounds(image.data, image.step, cv::Rect(0, 0, image.cols, image.rows));
+  }
+
+  // Source index and fixed point weight (of 2048) of the first of the two
+  // source samples for each of n destination samples, as cv::resize
+  // computes them for INTER_LINEAR.
+  inline void linear_coefficients(int n, int size, int* index, short* weight)
+  {
+    double scale = 1.0 / (double(n) / size);
+    for (int i = 0; i < n; ++i)
+    {
+      float f = float((i + 0.5) * scale - 0.5);
+      int s = int(std::floor(f));
+      f -= s;
+      if (s < 0) f = 0, s = 0;
+      if (s >= size - 1) f = 0, s = size - 1;
+      index[i] = s;
+      weight[i] = short(std::lrint((1.0f - f) * 2048));
+    }
+  }
+
+  // Resizes box of the buffer to n x n with cv::resize (INTER_LINEAR),
+  // thresholds it at 128 and packs it.  This is how glyphs were always
+  // normalized, the reference engine keeps doing it this way.
+  inline void resize_glyph(const unsigned char* data, size_t stride, const cv::Rect& box,
+                           int n, uint32_t* rows)
+  {
+    cv::Mat src(box.height, box.width, CV_8UC1,
+                const_cast<unsigned char*>(data + box.y * stride + box.x), stride);
+    cv::Mat image;
+    cv::resize(src, image, cv::Size(n, n));
+    cv::threshold(image, image, 128, 255, cv::THRESH_BINARY);
+    pack_glyph(image, n, rows);
+  }
+
+  // Resizes box of the buffer to n x n, thresholds it at 128 and
+  // packs it like pack_glyph, without intermediate images.  The arithmetic
+  // follows the fixed point rounding of the vectorized INTER_LINEAR code of
+  // cv::resize on 8 bit images, including its switch to area averaging for
+  // an exact 2x reduction.  OpenCV rounds differently in its scalar code,
+  // with IPP and in the bit exact resize of 4.x, so pixels within a grey
+  // level or two of the threshold can come out different from resize_glyph.
+  // tests/normalize_test measures how often.  n is at most 32.
+  inline void normalize_glyph(const unsigned char* data, size_t stride, const cv::Rect& box,
+                              int n, uint32_t* rows)
+  {
+    const unsigned char* base = data + box.y * stride + box.x;
+    if (box.width == n && box.height == n)
+    {
+      for (int y = 0; y < n; ++y)
+      {
+        const unsigned char* row = base + y * stride;
+        uint32_t bits = 0;
+        for (int x = 0; x < n; ++x)
+          bits |= uint32_t(row[x] <= 128) << x;
+        rows[y] = bits;
+      }
+      return;
+    }
+    if (box.width == 2 * n && box.height == 2 * n)
+    {
+      for (int y = 0; y < n; ++y)
+      {
+        const unsigned char* r0 = base + 2 * y * stride;
+        const unsigned char* r1 = r0 + stride;
+        uint32_t bits = 0;
+        for (int x = 0; x < n; ++x)
+        {
+          int sum = r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1];
+          bits |= uint32_t(((sum + 2) >> 2) <= 128) << x;
+        }
+        rows[y] = bits;
+      }
+      return;
+    }
+    int xs[32], ys[32], xs1[32];
+    short xw[32], yw[32];
+    linear_coefficients(n, box.width, xs, xw);
+    linear_coefficients(n, box.height, ys, yw);
+    for (int x = 0; x < n; ++x)
+      xs1[x] = std::min(xs[x] + 1, box.width - 1);
+    for (int y = 0; y < n; ++y)
+    {
+      const unsigned char* r0 = base + ys[y] * stride;
+      const unsigned char* r1 = base + std::min(ys[y] + 1, box.height - 1) * stride;
+      int b0 = yw[y], b1 = 2048 - b0;
+      uint32_t bits = 0;
+      for (int x = 0; x < n; ++x)
+      {
+        int a0 = xw[x], a1 = 2048 - a0;
+        int h0 = r0[xs[x]] * a0 + r0[xs1[x]] * a1;
+        int h1 = r1[xs[x]] * a0 + r1[xs1[x]] * a1;
+        int v = (((b0 * (h0 >> 4)) >> 16) + ((b1 * (h1 >> 4)) >> 16) + 2) >> 2;
+        bits |= uint32_t(v <= 128) << x;
+      }
+      rows[y] = bits;
+    }
+  }
+
+  inline void normalize_glyph(const cv::Mat& image, const cv::Rect& box, int n, uint32_t* rows)
+  {
+    normalize_glyph(image.data, image.step, box, n, rows);
+  }
+
+  // Number of pixels differing between two packed n x n glyphs
+  inline unsigned bitmap_distance(const uint32_t* a, const uint32_t* b, int n)
+  {
+    unsigned d = 0;
+    for (int y = 0; y < n; ++y)
+      d += bit_count(a[y] ^ b[y]);
+    return d;
+  }
+
+  // FNV-1a over the packed rows
+  inline uint64_t hash_rows(const uint32_t* rows, int n)
+  {
+    uint64_t h = 14695981039346656037ULL;
+    for (int y = 0; y < n; ++y)
+      for (int i = 0; i < 4; ++i)
+      {
+        h ^= (rows[y] >> (i * 8)) & 0xFF;
+        h *= 1099511628211ULL;
+      }
+    return h;
+  }
+
+} // namespace OpticMatch
+
+#endif // H_BITMAP_OPTMATCH
@@ -24,328 +24,1339 @@ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ***************************************************************************/
 #include "stdafx.h"
-#include "matrix.h"
-#include "utils.h"
+#include "perimeter.h"
+#include "parallel.h"
+#include "config.h"
+#include "mapped_file.h"
+#include "model_file.h"
+#include "bitmap.h"
+#include "vptree.h"
+#include "result_cache.h"
 
 namespace OpticMatch {
 
-  typedef unsigned char byte;
-  const int NSIZE = 24;
 
-  class PerimeterPixel
+  // Up to BLOCK_WIDTH consecutive templates of a class.  Template sets share
+  // their chunks and chunks share their templates and block, so a writer
+  // changing a set copies chunk pointers and the one chunk it changes.
+  template<int N>
+  struct OpticMatchTemplateChunk
   {
-    byte   px,py;
-    byte   gradients;
-  public:
-    PerimeterPixel(byte x = 0, byte y = 0)
-      : px(x), py(y), gradients(0)
-    {}
+    typedef Perimeter<N> perimeter;
+
+    std::shared_ptr<const perimeter> templates[BLOCK_WIDTH];
+    unsigned                         multiplicity[BLOCK_WIDTH];
+    uint32_t                         bitmaps[BLOCK_WIDTH * N];  // N packed rows per template
+    std::shared_ptr<AlignedBuffer>   block;  // Interleaved templates, null when not interleaved
+  };
+
+  // Templates of one class.  Training samples that normalize to the same
+  // glyph share a template, counted by its multiplicity.  Optionally every
+  // BLOCK_WIDTH templates are also interleaved into a block, giving lower
+  // bounds of their forward distances in one pass over the query points.
+  template<int N>
+  struct OpticMatchTemplateSet
+  {
+    typedef Perimeter<N>               perimeter;
+    typedef OpticMatchTemplateChunk<N> Chunk;
+    typedef std::unordered_multimap<uint64_t, size_t> HashIndex;
+
+    enum { BLOCK_BYTES = perimeter::PLANES * perimeter::PLANE_SIZE * BLOCK_WIDTH };
+
+    std::vector<std::shared_ptr<Chunk>> chunks;
+    size_t count;
+    // Bitmap hash to template.  Sets only grow by appending, so the copies
+    // of a set share one index, which writers extend.  Entries past count,
+    // or left by an update that was never published, never match the
+    // bitmap they point at and are skipped.
+    std::shared_ptr<HashIndex> index;
+
+    OpticMatchTemplateSet() : count(0), index(std::make_shared<HashIndex>()) {}
+
+    size_t size() const { return count; }
+    const perimeter& at(size_t i) const { return *shared(i); }
+    const std::shared_ptr<const perimeter>& shared(size_t i) const
+    {
+      return chunks[i / BLOCK_WIDTH]->templates[i % BLOCK_WIDTH];
+    }
+    const uint32_t* bitmap(size_t i) const { return chunks[i / BLOCK_WIDTH]->bitmaps + (i % BLOCK_WIDTH) * N; }
+    unsigned multiplicity(size_t i) const { return chunks[i / BLOCK_WIDTH]->multiplicity[i % BLOCK_WIDTH]; }
+
+    // Interleaved block b, holding templates from b * BLOCK_WIDTH, or null
+    const byte* block(size_t b) const
+    {
+      const Chunk& c = *chunks[b];
+      return c.block ? c.block->data() : nullptr;
+    }
+
+    // Template with exactly these rows, or size() if none
+    size_t find(const uint32_t* rows) const
+    {
+      auto range = index->equal_range(hash_rows(rows, N));
+      for (auto it = range.first; it != range.second; ++it)
+        if (it->second < count && std::equal(rows, rows + N, bitmap(it->second))) return it->second;
+      return count;
+    }
+
+    void add_sample(size_t i)
+    {
+      ++writable(i / BLOCK_WIDTH).multiplicity[i % BLOCK_WIDTH];
+    }
 
-    byte x() const { return px; }
-    byte y() const { return py; }
-    byte g() const { return gradients; }
+    void add(std::shared_ptr<const perimeter> p, const uint32_t* rows, unsigned mult, bool interleave)
+    {
+      size_t t = count % BLOCK_WIDTH;
+      if (t == 0) chunks.resize(count / BLOCK_WIDTH + 1);
+      Chunk& c = writable(count / BLOCK_WIDTH);
+      index->insert(std::make_pair(hash_rows(rows, N), count));
+      c.templates[t] = std::move(p);
+      c.multiplicity[t] = mult;
+      std::copy(rows, rows + N, c.bitmaps + t * N);
+      ++count;
+      if (interleave) interleave_into(c, t);
+    }
 
-    void set_grad(byte g)    { gradients = g; }
-    void add_grad(byte g)    { gradients |= g; }
-    void set(byte x, byte y) { px = x; py = y; }
+  private:
+    // Chunk k, copied first if another set shares it.  Only writers copy
+    // sets, so the use count cannot grow meanwhile.
+    Chunk& writable(size_t k)
+    {
+      std::shared_ptr<Chunk>& c = chunks[k];
+      if (!c) c = std::make_shared<Chunk>();
+      else
+      if (c.use_count() > 1) c = std::make_shared<Chunk>(*c);
+      return *c;
+    }
+
+    static void interleave_into(Chunk& c, size_t t)
+    {
+      if (!c.block)
+      {
+        c.block = std::make_shared<AlignedBuffer>(BLOCK_BYTES);
+        memset(c.block->data(), 0, BLOCK_BYTES);
+      }
+      else
+      if (c.block.use_count() > 1) c.block = std::make_shared<AlignedBuffer>(*c.block);
+      const perimeter& p = *c.templates[t];
+      byte* column = c.block->data() + t;
+      for (unsigned o = 0; o < perimeter::PLANES * perimeter::PLANE_SIZE; ++o)
+        column[o * BLOCK_WIDTH] = byte(std::min(p.distance_at(o), 255U));
+    }
   };
 
-  class Cell
+  // Vantage point tree over the templates of a model.  A model updated by
+  // adding samples keeps the tree of the model it came from while the
+  // templates added since, which queries match one by one, are few
+  // compared to the tree.
+  template<int N>
+  struct OpticMatchIndex
   {
-    byte           m_X,m_Y;
-    unsigned short m_SqDist;
-  public:
-    Cell(unsigned x = 0, unsigned y = 0, unsigned short sqdist = 65535)
-      : m_X(x)
-      , m_Y(y)
-      , m_SqDist(sqdist)
-    {}
-
-    byte x() const { return m_X; }
-    byte y() const { return m_Y; }
-
-    unsigned short sqr_dist() const { return m_SqDist; }
-    void set(unsigned short sd) { m_SqDist = sd; }
-    void set(byte x, byte y) { m_X = x; m_Y = y; }
-    void set(byte x, byte y, unsigned short sd) { set(x, y); m_SqDist = sd; }
+    VpTree tree;
+    std::vector<std::pair<wchar_t, const Perimeter<N>*>> items;  // In scan order
+    std::map<wchar_t, size_t> counts;  // Templates of each class in the tree, the first ones of its set
   };
 
-  inline std::ostream& operator << (std::ostream& os, const Cell& c)
+  // Everything classify reads about the trained templates.  A published
+  // model is never changed: writers build a new one, sharing the template
+  // sets of the classes they do not touch, and readers keep the model they
+  // started a query with until it is done.
+  template<int N>
+  struct OpticMatchModel
   {
-    return os << c.sqr_dist();
-  }
+    typedef Perimeter<N>             perimeter;
+    typedef OpticMatchTemplateSet<N> TemplateSet;
+
+    std::map<wchar_t, std::shared_ptr<TemplateSet>> sets;
+    std::vector<wchar_t> classes;  // Keys of sets, in order
+    std::shared_ptr<const OpticMatchIndex<N>> index;  // Null when disabled
+    size_t               template_count;
+    uint64_t             generation;  // Unique in the process, tags cached results
+
+    OpticMatchModel() : template_count(0), generation(0) {}
+
+    // Set of c that only this model holds, copying a shared one.  Only
+    // writers copy models, so the use count cannot grow meanwhile.
+    TemplateSet& writable(wchar_t c)
+    {
+      std::shared_ptr<TemplateSet>& ts = sets[c];
+      if (!ts) ts = std::make_shared<TemplateSet>();
+      else
+      if (ts.use_count() > 1) ts = std::make_shared<TemplateSet>(*ts);
+      return *ts;
+    }
+  };
 
-  typedef Matrix<Cell> cell_mat;
-  typedef std::list<PerimeterPixel> pp_seq;
-  typedef std::vector<cell_mat> cm_vec;
-  typedef std::vector<byte> bvec;
+  // A template whose forward distance is known, for the lazy classify
+  template<int N>
+  struct LazyCandidate
+  {
+    unsigned               forward;
+    size_t                 order;  // Position in the scan, later wins ties
+    wchar_t                ch;
+    const Perimeter<N>*    t;
 
-  const int LEFT_IDX = 0;
-  const int TOP_IDX = 1;
-  const int RIGHT_IDX = 2;
-  const int BOTTOM_IDX = 3;
+    // Nearer forward distance first, then the later template
+    bool operator< (const LazyCandidate& o) const
+    {
+      return forward < o.forward || (forward == o.forward && order > o.order);
+    }
+  };
 
-  const unsigned LEFT = 1;
-  const unsigned TOP = 2;
-  const unsigned RIGHT = 4;
-  const unsigned BOTTOM = 8;
+  template<int N>
+  class OpticMatchClassifyContext : public ClassifyContext
+  {
+  public:
+    uint32_t     rows[N];  // normalized query, packed
+    float        aspect;   // of the query before normalization, 0 if unknown
+    Perimeter<N> query;
+    VpTree::frontier open;
+    std::vector<LazyCandidate<N>> candidates;
+    std::vector<unsigned> coarse;  // Subsample distance of each template, in scan order
+    std::shared_ptr<const OpticMatchModel<N>> model;  // Last model this context classified with
 
-  static const cell_mat s_EmptyMat(NSIZE, NSIZE, Cell());
-  static const byte blank_row[] = { 255, 255, 255, 255, 255, 255, 255, 255,
-                                    255, 255, 255, 255, 255, 255, 255, 255,
-                                    255, 255, 255, 255, 255, 255, 255, 255,
-                                    255, 255, 255, 255, 255, 255, 255, 255 };
+    OpticMatchClassifyContext()
+    {
+      query.reserve(Perimeter<N>::PLANE_SIZE);
+      open.reserve(64);
+    }
+  };
 
-  class Perimeter
+  template<int N>
+  class OpticMatchCharClassifier : public CharClassifier
   {
-    typedef std::vector<PerimeterPixel> pp_vec;
-    pp_vec  m_Points;
-    cm_vec  m_Matrices;
+    typedef Perimeter<N>                perimeter;
+    typedef OpticMatchTemplateSet<N>    TemplateSet;
+    typedef OpticMatchModel<N>          Model;
+    typedef OpticMatchIndex<N>          Index;
+    typedef std::shared_ptr<const Model> model_ptr;
+    typedef OpticMatchClassifyContext<N> context;
+
+    // Read with std::atomic_load only when m_Generation says it changed
+    model_ptr            m_Model;
+    std::atomic<uint64_t> m_Generation;
+    std::mutex           m_WriteLock;  // Serializes writers, classify never takes it
+    match_kernel         m_Kernel;
+    block_kernel         m_BlockKernel;
+    DistanceTransform    m_Transform;
+    ClassifierConfig     m_Config;
 
-    inline void check(cell_mat& m, const Cell& o, int x, int y, pp_seq& horizon)
+    mutable std::atomic<unsigned long> m_Queries;
+    mutable std::atomic<unsigned long> m_Matched;
+    mutable std::atomic<unsigned long> m_Pruned;
+    mutable std::atomic<unsigned long> m_Bounded;
+    mutable std::atomic<unsigned long> m_Checked;
+    mutable std::atomic<unsigned long> m_Changed;
+    mutable std::atomic<unsigned long> m_Searches;
+    mutable std::atomic<unsigned long> m_Visited;
+    mutable std::atomic<unsigned long> m_Reversed;
+    mutable std::atomic<unsigned long> m_Coarse;
+    mutable ResultCache<N>             m_Cache;
+
+    // Cheap tests that skip templates before matching.  Templates further
+    // than descriptor from the query's descriptor, or with more than pixels
+    // differing pixels, are pruned; zero disables a test.
+    struct Prefilter
     {
-      unsigned short sd = sqr(x - int(o.x())) + sqr(y - int(o.y()));
-      if (sd < m(x, y).sqr_dist())
-      {
-        m(x, y).set(o.x(), o.y(), sd);
-        horizon.push_back(PerimeterPixel(x, y));
-      }
+      double          descriptor;
+      unsigned        pixels;
+      const uint32_t* rows;
+
+      Prefilter() : descriptor(0), pixels(0), rows(nullptr) {}
+      bool active() const { return descriptor > 0 || pixels > 0; }
+    };
+
+    struct ScanCounters
+    {
+      unsigned long matched, pruned, bounded, reversed, coarse;
+      ScanCounters() : matched(0), pruned(0), bounded(0), reversed(0), coarse(0) {}
+    };
+
+    static float aspect_of(const cv::Size& size)
+    {
+      return size.height > 0 ? float(size.width) / size.height : 0.0f;
+    }
+
+    // Ordering of top-k entries, ties go to the later class like in classify
+    static bool better(const ClassScore& a, const ClassScore& b)
+    {
+      return a.distance < b.distance || (a.distance == b.distance && a.ch > b.ch);
+    }
+
+    // Symmetric match distance with the configured thresholds, see bounded_distance
+    unsigned distance(const perimeter& q, const perimeter& t, unsigned bound) const
+    {
+      return bounded_distance(q, t, m_Config.thres, bound, m_Kernel, m_Config.dest_thres);
+    }
+
+    // Worker count for a call asking for threads, 0 takes the configured count
+    unsigned workers(unsigned threads) const
+    {
+      return threads ? threads : m_Config.threads;
     }
 
-    void finalize_matrix(cell_mat& m)
+    static uint64_t next_generation()
     {
-      static int cnt = 0; ++cnt;
+      static std::atomic<uint64_t> generation(0);
+      return ++generation;
+    }
 
-      int x, y, w = m.get_width(), h = m.get_height();
-      pp_seq horizon;
-      for (y = 0; y < h; ++y)
+    // The published model, as seen by ctx.  The context keeps its model
+    // until a writer publishes another one, so in steady state classify only
+    // reads m_Generation.  Taking a model sizes the context's per template
+    // buffers for it, so queries on it do not grow them.
+    const Model& snapshot(context& ctx) const
+    {
+      if (!ctx.model || ctx.model->generation != m_Generation.load(std::memory_order_acquire))
       {
-        Cell* row = m.get_row(y);
-        for (x = 0; x < w; ++x)
+        ctx.model = std::atomic_load(&m_Model);
+        size_t templates = ctx.model->template_count;
+        if (m_Config.coarse_margin > 0) ctx.coarse.reserve(templates);
+        if (m_Config.lazy)
         {
-          if (row[x].sqr_dist() == 0)
-          {
-            row[x].set(x, y);
-            horizon.push_back(PerimeterPixel(x, y));
-          }
+          size_t limit = (m_Config.lazy_candidates > 0 ? m_Config.lazy_candidates : templates);
+          ctx.candidates.reserve(std::min(limit, templates));
         }
       }
+      return *ctx.model;
+    }
 
-      while (!horizon.empty())
+    // A copy of the published model for a writer to add templates to,
+    // sharing its template sets and tree.  Call with m_WriteLock held.
+    std::shared_ptr<Model> draft() const
+    {
+      model_ptr current = std::atomic_load(&m_Model);
+      std::shared_ptr<Model> m = std::make_shared<Model>();
+      m->sets = current->sets;
+      m->index = current->index;
+      return m;
+    }
+
+    // Tree over all templates of m.  Tree items follow the scan order, so
+    // the tree breaks ties like scan does.
+    std::shared_ptr<const Index> build_index(const Model& m) const
+    {
+      std::shared_ptr<Index> index = std::make_shared<Index>();
+      for (const auto& cls : m.sets)
       {
-        PerimeterPixel p = horizon.front();
-        horizon.pop_front();
-        x = p.x();
-        y = p.y();
-        const Cell& o = m(x, y);
+        for (size_t i = 0; i < cls.second->size(); ++i)
+          index->items.push_back(std::make_pair(cls.first, &cls.second->at(i)));
+        index->counts[cls.first] = cls.second->size();
+      }
+      const Index& idx = *index;
+      index->tree.build(index->items.size(), [this, &idx](size_t a, size_t b)
+      {
+        return distance(*idx.items[b].second, *idx.items[a].second, UINT_MAX);
+      });
+      return index;
+    }
 
-        if (x > 0)       check(m, o, x - 1, y, horizon);
-        if (x < (w - 1)) check(m, o, x + 1, y, horizon);
-        if (y > 0)       check(m, o, x, y - 1, horizon);
-        if (y < (h - 1)) check(m, o, x, y + 1, horizon);
+    // Completes m and makes it the model of new queries.  Call with
+    // m_WriteLock held.  The tree of a drafted model is rebuilt once the
+    // templates added since it was built exceed an eighth of it, so adding
+    // samples one by one costs amortized O(log n) distances each.  The
+    // rebuild runs under m_WriteLock, so the update that triggers it takes
+    // O(n log n) distances and other writers wait for it; queries keep
+    // using the previous model meanwhile.
+    void publish(std::shared_ptr<Model> m)
+    {
+      size_t total = 0;
+      for (const auto& cls : m->sets)
+      {
+        m->classes.push_back(cls.first);
+        total += cls.second->size();
       }
+      m->template_count = total;
+      if (!m_Config.vptree)
+        m->index.reset();
+      else
+      if (!m->index || (total - m->index->items.size()) * 8 > m->index->items.size())
+        m->index = build_index(*m);
+      m->generation = next_generation();
+      uint64_t generation = m->generation;
+      std::atomic_store(&m_Model, model_ptr(std::move(m)));
+      m_Generation.store(generation, std::memory_order_release);
     }
 
-    void minimize_matrix(cell_mat& dst, const cell_mat& src)
+    // Nearest template found through the tree, or among the templates
+    // added after the tree was built.  The match distance is not a metric,
+    // so the tree may miss the nearest template even without a budget.
+    wchar_t search_index(const Model& model, const perimeter& p, context& ctx, unsigned& best,
+                         ScanCounters& counters) const
     {
-      unsigned x, y, w = dst.get_width(), h = dst.get_height();
-      for (y = 0; y < h; ++y)
+      const Index& index = *model.index;
+      size_t visited;
+      best = UINT_MAX;
+      size_t item = index.tree.search([this, &index, &p](size_t i)
       {
-        Cell* drow = dst.get_row(y);
-        const Cell* srow = src.get_row(y);
-        for (x = 0; x < w; ++x)
+        return distance(p, *index.items[i].second, UINT_MAX);
+      }, best, m_Config.vptree_budget, ctx.open, &visited);
+      ++m_Searches;
+      m_Visited += visited;
+      counters.matched += visited;
+      wchar_t best_char = (item == SIZE_MAX ? wchar_t(0) : index.items[item].first);
+      for (const auto& cls : model.sets)
+      {
+        auto in_tree = index.counts.find(cls.first);
+        for (size_t i = (in_tree == index.counts.end() ? 0 : in_tree->second); i < cls.second->size(); ++i)
         {
-          if (srow[x].sqr_dist() < drow[x].sqr_dist())
-            drow[x] = srow[x];
+          ++counters.matched;
+          unsigned d = distance(p, cls.second->at(i), best);
+          if (d <= best)
+          {
+            best = d;
+            best_char = cls.first;
+          }
         }
       }
+      return best_char;
     }
 
-    void finalize_matrices()
+    static context& local_context()
     {
-      for (unsigned i = 0; i < 4; ++i)
-        finalize_matrix(m_Matrices[i]);
-      cm_vec mat16(16, s_EmptyMat);
-      for (unsigned i = 0; i < 16; ++i)
-      {
-        if ((i & LEFT)   == LEFT)   minimize_matrix(mat16[i], m_Matrices[LEFT_IDX]);
-        if ((i & TOP)    == TOP)    minimize_matrix(mat16[i], m_Matrices[TOP_IDX]);
-        if ((i & RIGHT)  == RIGHT)  minimize_matrix(mat16[i], m_Matrices[RIGHT_IDX]);
-        if ((i & BOTTOM) == BOTTOM) minimize_matrix(mat16[i], m_Matrices[BOTTOM_IDX]);
-      }
-      m_Matrices.swap(mat16);
+      static thread_local context ctx;
+      return ctx;
     }
-  public:
-    Perimeter() {}
 
-    Perimeter(const cv::Mat& image)
+    // Normalizes box of a buffer to N x N packed rows.  The reference
+    // engine uses cv::resize, the fused normalize_glyph may differ from it
+    // in pixels next to the threshold.
+    void normalize(const unsigned char* data, size_t stride, const cv::Rect& box, uint32_t* rows) const
     {
-      build_matrices(image);
+      if (m_Config.engine == ENGINE_REFERENCE)
+        resize_glyph(data, stride, box, N, rows);
+      else
+        normalize_glyph(data, stride, box, N, rows);
     }
 
-    void build_matrices(const cv::Mat& image)
+    // Fills ctx.rows and ctx.aspect from the roi of a buffer
+    void pack_query(const unsigned char* data, size_t stride, const cv::Rect& roi, context& ctx) const
     {
-      if (m_Matrices.empty())
+      // An N x N image is taken as already normalized, its aspect is unknown
+      ctx.aspect = 0;
+      if (roi.width != N || roi.height != N)
       {
-        m_Matrices.resize(4, s_EmptyMat);
+        cv::Rect box = glyph_bounds(data, stride, roi);
+        ctx.aspect = aspect_of(box.size());
+        normalize(data, stride, box, ctx.rows);
       }
-      unsigned w = image.cols, h = image.rows;
-      for (unsigned y = 0; y < h; ++y)
+      else
+        pack_glyph(data + roi.y * stride + roi.x, stride, N, ctx.rows);
+      ++m_Queries;
+    }
+
+    void pack_query(const cv::Mat& image, context& ctx) const
+    {
+      pack_query(image.data, image.step, cv::Rect(0, 0, image.cols, image.rows), ctx);
+    }
+
+    // Without planes, only matching the query's points on templates works
+    const perimeter& build_query(context& ctx, bool planes = true) const
+    {
+      ctx.query.build_points(ctx.rows);
+      ctx.query.set_aspect(ctx.aspect);
+      if (planes) ctx.query.build_planes(m_Transform);
+      return ctx.query;
+    }
+
+    // The checks of the classify calls taking a whole image
+    static void check_image(const cv::Mat& image)
+    {
+      if (image.empty()) throw invalid_parameters_exception("Invalid classify region.");
+      if (image.type() != CV_8UC1) throw invalid_parameters_exception("Only grayscale images are accepted.");
+    }
+
+    const perimeter& query_perimeter(const cv::Mat& image, context& ctx) const
+    {
+      pack_query(image, ctx);
+      return build_query(ctx);
+    }
+
+    // The aspect only changes results through the descriptor prefilter
+    float cache_aspect(const context& ctx) const
+    {
+      return m_Config.prefilter > 0 ? ctx.aspect : 0.0f;
+    }
+
+    Prefilter prefilter(const context& ctx) const
+    {
+      Prefilter pf;
+      pf.descriptor = m_Config.prefilter;
+      pf.pixels = unsigned(m_Config.pixel_prefilter * N * N);
+      pf.rows = ctx.rows;
+      return pf;
+    }
+
+    // Lowers best to the smallest distance of a template in s that passes
+    // the prefilter.  Returns false if no template is within best.  Ties go
+    // to the later template, the same one the highest score would pick from
+    // an ordered scan.
+    bool class_distance(const perimeter& p, const TemplateSet& s, const Prefilter& pf,
+                        unsigned& best, ScanCounters& counters) const
+    {
+      const GlyphDescriptor& pd = p.descriptor();
+      bool found = false;
+      unsigned lower[BLOCK_WIDTH];
+      size_t block = SIZE_MAX;
+      const byte* block_data = nullptr;
+      for (size_t i = 0; i < s.size(); ++i)
       {
-        const byte* prow = (y == 0 ? &blank_row[0] : image.ptr(y - 1));
-        const byte* crow = image.ptr(y);
-        const byte* nrow = (y == (h - 1) ? &blank_row[0] : image.ptr(y + 1));
-        for (unsigned x = 0; x < w; ++x)
+        const perimeter& rp = s.at(i);
+        if ((pf.pixels > 0 && bitmap_distance(pf.rows, s.bitmap(i), N) > pf.pixels) ||
+            (pf.descriptor > 0 && descriptor_distance(pd, rp.descriptor()) > pf.descriptor))
+        {
+          ++counters.pruned;
+          continue;
+        }
+        if (i / BLOCK_WIDTH != block)
         {
-          if (crow[x] == 0)
+          block = i / BLOCK_WIDTH;
+          block_data = s.block(block);
+          if (block_data)
           {
-            if (x == 0 || x == (w - 1) || crow[x - 1] == 255 || crow[x + 1] == 255 || prow[x] == 255 || nrow[x] == 255)
-            {
-              m_Points.push_back(PerimeterPixel(x, y));
-              if (x == 0 || crow[x - 1] == 255)
-              {
-                (m_Matrices[LEFT_IDX])  (x, y).set(0);
-                m_Points.back().add_grad(LEFT);
-              }
-              if (x == (w - 1) || crow[x + 1] == 255)
-              {
-                (m_Matrices[RIGHT_IDX]) (x, y).set(0);
-                m_Points.back().add_grad(RIGHT);
-              }
-              if (prow[x] == 255)
-              {
-                (m_Matrices[TOP_IDX])   (x, y).set(0);
-                m_Points.back().add_grad(TOP);
-              }
-              if (nrow[x] == 255)
-              {
-                (m_Matrices[BOTTOM_IDX])(x, y).set(0);
-                m_Points.back().add_grad(BOTTOM);
-              }
-            }
+            std::fill(lower, lower + BLOCK_WIDTH, 0U);
+            m_BlockKernel(block_data, p.offsets(), p.point_count(), m_Config.thres, lower);
           }
         }
+        if (block_data)
+        {
+          if (lower[i % BLOCK_WIDTH] > best)
+          {
+            ++counters.bounded;
+            continue;
+          }
+        }
+        ++counters.matched;
+        unsigned d = distance(p, rp, m_Config.engine == ENGINE_REFERENCE ? UINT_MAX : best);
+        if (d <= best)
+        {
+          best = d;
+          found = true;
+        }
       }
-      finalize_matrices();
+      return found;
     }
 
-    typedef pp_vec::const_iterator const_iterator;
-    const_iterator begin() const { return m_Points.begin(); }
-    const_iterator end()   const { return m_Points.end(); }
+    // Branch and bound over all templates within bound
+    wchar_t scan(const Model& model, const perimeter& p, const Prefilter& pf, unsigned& best,
+                 ScanCounters& counters, unsigned bound = UINT_MAX) const
+    {
+      wchar_t best_char = wchar_t(0);
+      best = bound;
+      for (auto it = model.sets.begin(); it != model.sets.end();++it)
+      {
+        if (class_distance(p, *it->second, pf, best, counters))
+          best_char = it->first;
+      }
+      return best_char;
+    }
 
-    unsigned match(const Perimeter& p, unsigned thres) const
+    // Keeps the k best classes as a max-heap on out, worst entry first
+    size_t scan_topk(const Model& model, const perimeter& p, const Prefilter& pf, size_t k, ClassScore* out,
+                     ScanCounters& counters) const
     {
-      const int DEST_THRES = 4;
-      unsigned sum = 0;
-      Matrix<byte> count_mat(NSIZE, NSIZE, 0);
-      for (const_iterator it = p.begin(); it != p.end(); ++it)
+      size_t n = 0;
+      for (auto it = model.sets.begin(); it != model.sets.end(); ++it)
       {
-        const PerimeterPixel& pp = *it;
-        byte g = pp.g();
-        const Cell& cell = (m_Matrices[g])(pp.x(), pp.y());
-        unsigned d = cell.sqr_dist();
-        if (d > thres)
+        unsigned d = (n == k ? out[0].distance : UINT_MAX);
+        if (!class_distance(p, *it->second, pf, d, counters)) continue;
+        ClassScore cs = { it->first, score_from_distance<N>(d), d };
+        if (n < k)
         {
-          sum += d;
-          byte& count_cell = count_mat(cell.x(), cell.y());
-          if (++count_cell > DEST_THRES)
-          {
-            if (count_cell > (DEST_THRES + 1))
-              sum -= sqr(unsigned(count_cell) - 1U);
-            sum += sqr(unsigned(count_cell));
-          }
+          out[n++] = cs;
+          std::push_heap(out, out + n, better);
+        }
+        else
+        {
+          std::pop_heap(out, out + n, better);
+          out[n - 1] = cs;
+          std::push_heap(out, out + n, better);
         }
       }
-      return sum;
+      return n;
     }
-  };
 
-  double match(const Perimeter& a, const Perimeter& b, unsigned thres)
-  {
-    const double mult = sqr(1.0 / NSIZE);
-    unsigned ma = a.match(b, thres);
-    unsigned mb = b.match(a, thres);
-    double m = 0.5*(ma + mb)*mult;
-    return exp(-m);
-  }
+    // A training sample on its way to a model
+    struct Sample
+    {
+      cv::Mat   image;
+      wchar_t   ch;
+      uint32_t  rows[N];
+      perimeter p;
+      bool      duplicate;  // Of a template already in the model, p is not built
+    };
 
-  void crop(cv::Mat& image);
+    // Normalizes and builds s.  Only reads m, so samples can be prepared
+    // concurrently while nothing is merged.
+    void prepare_sample(const Model& m, Sample& s) const
+    {
+      if (s.image.channels() != 1) throw invalid_parameters_exception("Only grayscale images are accepted.");
+      normalize(s.image.data, s.image.step, cv::Rect(0, 0, s.image.cols, s.image.rows), s.rows);
+      auto it = m.sets.find(s.ch);
+      s.duplicate = (it != m.sets.end() && it->second->find(s.rows) < it->second->size());
+      if (s.duplicate) return;
+      s.p = perimeter(s.rows, m_Transform);
+      s.p.set_aspect(aspect_of(s.image.size()));
+      convert_planes(s.p);
+    }
 
-  class OpticMatchCharClassifier : public CharClassifier
-  {
-    typedef std::vector<Perimeter>  pseq;
-    typedef std::map<wchar_t, pseq> ts_map;
+    // Returns true if s became a new template.  Samples prepared together
+    // may still duplicate each other, which is only seen here.
+    bool merge_sample(Model& m, Sample& s) const
+    {
+      TemplateSet& ts = m.writable(s.ch);
+      size_t dup = ts.find(s.rows);
+      if (dup < ts.size())
+      {
+        ts.add_sample(dup);
+        return false;
+      }
+      ts.add(std::make_shared<const perimeter>(std::move(s.p)), s.rows, 1, m_Config.interleave);
+      return true;
+    }
 
-    ts_map m_TS;
+    // Nearest template's class and distance for the built query
+    // Forward halves (query points on the template planes) of all templates
+    // first, keeping the lazy_candidates nearest.  Only then are the query's
+    // planes built, and the reverse halves run on the candidates in forward
+    // order until the forward half alone exceeds the best distance.  Exact
+    // when all templates are candidates, since the forward half is a lower
+    // bound of the distance.
+    wchar_t classify_lazy(const Model& model, context& ctx, unsigned& best, ScanCounters& counters) const
+    {
+      const perimeter& q = build_query(ctx, false);
+      size_t limit = m_Config.lazy_candidates > 0 ? m_Config.lazy_candidates : SIZE_MAX;
+      std::vector<LazyCandidate<N>>& heap = ctx.candidates;
+      heap.clear();
+      size_t order = 0;
+      for (const auto& cls : model.sets)
+        for (size_t i = 0; i < cls.second->size(); ++i)
+        {
+          const perimeter& t = cls.second->at(i);
+          unsigned bound = (heap.size() == limit ? heap.front().forward : UINT_MAX);
+          LazyCandidate<N> c = { t.match(q, m_Config.thres, bound, m_Kernel, m_Config.dest_thres), order++, cls.first, &t };
+          ++counters.matched;
+          if (heap.size() == limit)
+          {
+            if (!(c < heap.front())) continue;
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = c;
+          }
+          else
+            heap.push_back(c);
+          std::push_heap(heap.begin(), heap.end());
+        }
+      std::sort_heap(heap.begin(), heap.end());
+      ctx.query.build_planes(m_Transform);
+      wchar_t best_char = wchar_t(0);
+      size_t best_order = 0;
+      best = UINT_MAX;
+      for (const LazyCandidate<N>& c : heap)
+      {
+        if (c.forward > best) break;
+        ++counters.reversed;
+        unsigned d = c.forward + q.match(*c.t, m_Config.thres, best == UINT_MAX ? UINT_MAX : best - c.forward,
+                                           m_Kernel, m_Config.dest_thres);
+        if (d < best || (d == best && c.order > best_order))
+        {
+          best = d;
+          best_order = c.order;
+          best_char = c.ch;
+        }
+      }
+      return best_char;
+    }
+
+    // Coarse to fine: every template is first matched on the first quarter
+    // of the query's points, an even subsample of its outline.  Only the
+    // templates within coarse_margin per subsampled point of the nearest
+    // one get the full match, in scan order.  The margin is in the units of
+    // the match, squared grid distances beyond thres, and the subsample
+    // ranks templates poorly: the nearest template is often far from the
+    // subsample leader, so small margins change many results.
+    wchar_t classify_coarse(const Model& model, context& ctx, unsigned& best, ScanCounters& counters) const
+    {
+      const perimeter& p = build_query(ctx);
+      unsigned points = (p.point_count() + 3) / 4;
+      unsigned margin = unsigned(m_Config.coarse_margin * points);
+      std::vector<unsigned>& coarse = ctx.coarse;
+      coarse.clear();
+      unsigned leader = UINT_MAX;
+      for (const auto& cls : model.sets)
+        for (size_t i = 0; i < cls.second->size(); ++i)
+        {
+          const perimeter& t = cls.second->at(i);
+          unsigned bound = (leader == UINT_MAX ? UINT_MAX : leader + margin);
+          unsigned d = t.match_prefix(p, points, m_Config.thres, bound, m_Kernel, m_Config.dest_thres);
+          ++counters.coarse;
+          leader = std::min(leader, d);
+          coarse.push_back(d);
+        }
+      unsigned cutoff = leader + margin;
+      wchar_t best_char = wchar_t(0);
+      best = UINT_MAX;
+      size_t k = 0;
+      for (const auto& cls : model.sets)
+        for (size_t i = 0; i < cls.second->size(); ++i)
+        {
+          if (coarse[k++] > cutoff) continue;
+          const perimeter& t = cls.second->at(i);
+          ++counters.matched;
+          unsigned d = distance(p, t, best);
+          if (d <= best)
+          {
+            best = d;
+            best_char = cls.first;
+          }
+        }
+      return best_char;
+    }
+
+    wchar_t classify_query(const Model& model, context& ctx, unsigned& best) const
+    {
+      ScanCounters counters;
+      if (!model.index && (m_Config.lazy || m_Config.coarse_margin > 0))
+      {
+        wchar_t best_char = (m_Config.lazy ? classify_lazy(model, ctx, best, counters)
+                                           : classify_coarse(model, ctx, best, counters));
+        flush(counters);
+        return best_char;
+      }
+      const perimeter& p = build_query(ctx);
+      if (model.index)
+      {
+        wchar_t best_char = search_index(model, p, ctx, best, counters);
+        // Exact search: the tree's distance bounds a scan, which still finds
+        // the tree's template if nothing is nearer
+        if (m_Config.vptree_budget == 0)
+          best_char = scan(model, p, Prefilter(), best, counters, best);
+        flush(counters);
+        return best_char;
+      }
+      Prefilter pf = prefilter(ctx);
+      wchar_t best_char = scan(model, p, pf, best, counters);
+      // Everything pruned, the prefilter is too tight for this glyph
+      if (best == UINT_MAX && pf.active())
+        best_char = scan(model, p, Prefilter(), best, counters);
+      else
+      if (pf.active() && m_Config.prefilter_check)
+      {
+        unsigned full_best;
+        wchar_t full_char = scan(model, p, Prefilter(), full_best, counters);
+        ++m_Checked;
+        if (full_char != best_char) ++m_Changed;
+      }
+      flush(counters);
+      return best_char;
+    }
 
+    // Templates are built with full planes, then stored as configured
+    void convert_planes(perimeter& p) const
+    {
+      if (m_Config.planes == PLANES_COMPACT) p.compact();
+      else
+      if (m_Config.planes == PLANES_LEAN) p.lean(m_Config.lean_share);
+    }
 
-    static cv::Mat normalize(const cv::Mat& src_image)
+    void flush(const ScanCounters& counters) const
     {
-      cv::Mat image;
-      cv::resize(src_image, image, cv::Size(NSIZE, NSIZE));
-      cv::threshold(image, image, 128, 255, cv::THRESH_BINARY);
-      return image;
+      m_Matched += counters.matched;
+      m_Pruned += counters.pruned;
+      m_Bounded += counters.bounded;
+      m_Reversed += counters.reversed;
+      m_Coarse += counters.coarse;
     }
 
   public:
-    OpticMatchCharClassifier() {}
+    OpticMatchCharClassifier(const ClassifierConfig& cfg)
+      : m_Generation(0)
+      , m_Kernel(select_match_kernel(cfg.kernel))
+      , m_BlockKernel(select_block_kernel(cfg.kernel))
+      , m_Transform(cfg.transform)
+      , m_Config(cfg)
+      , m_Queries(0)
+      , m_Matched(0)
+      , m_Pruned(0)
+      , m_Bounded(0)
+      , m_Checked(0)
+      , m_Changed(0)
+      , m_Searches(0)
+      , m_Visited(0)
+      , m_Reversed(0)
+      , m_Coarse(0)
+      , m_Cache(cfg.cache)
+    {
+      std::shared_ptr<Model> m = std::make_shared<Model>();
+      m->generation = next_generation();
+      m_Generation = m->generation;
+      m_Model = std::move(m);
+    }
 
     virtual bool add_training_sample(const cv::Mat& image, wchar_t c) override
     {
-      if (image.channels() != 1) throw invalid_parameters_exception("Only grayscale images are accepted.");
-      cv::Mat img = normalize(image);
-      auto it = m_TS.find(c);
-      if (it==m_TS.end())
-        it=m_TS.insert(std::make_pair(c,pseq())).first;
-      pseq& s = it->second;
-      s.push_back(Perimeter());
-      s.back().build_matrices(img);
+      add_training_samples(&image, &c, 1, 1);
       return true;
     }
 
-    virtual bool train(CharImageGenerator& cig) override
+    virtual size_t add_training_samples(const cv::Mat* images, const wchar_t* chars, size_t count,
+                                        unsigned threads) override
     {
-      cv::Mat img;
-      wchar_t c;
-      int n = 0;
-      while (cig.generate(img,c))
-        add_training_sample(img, c);
-      return n>0;
+      std::lock_guard<std::mutex> lock(m_WriteLock);
+      std::shared_ptr<Model> m = draft();
+      std::vector<Sample> samples(count);
+      parallel_for(count, workers(threads), 8, [&](unsigned, size_t begin, size_t end)
+      {
+        for (size_t i = begin; i < end; ++i)
+        {
+          samples[i].image = images[i];
+          samples[i].ch = chars[i];
+          prepare_sample(*m, samples[i]);
+        }
+      });
+      size_t added = 0;
+      for (Sample& s : samples)
+        if (merge_sample(*m, s)) ++added;
+      publish(std::move(m));
+      return added;
     }
 
+    virtual bool train(CharImageGenerator& cig, TrainStats* stats, unsigned threads) override;
+
     virtual wchar_t classify(const cv::Mat& image, double* conf) const override
     {
-      if (m_TS.empty())
+      return classify(image, local_context(), conf);
+    }
+
+    virtual std::shared_ptr<ClassifyContext> create_context() const override
+    {
+      return std::make_shared<context>();
+    }
+
+    virtual wchar_t classify(const cv::Mat& image, ClassifyContext& ctx, double* conf) const override
+    {
+      check_image(image);
+      return classify(image.data, int(image.step), cv::Rect(0, 0, image.cols, image.rows), ctx, conf);
+    }
+
+    virtual wchar_t classify(const uint8_t* data, int stride, const cv::Rect& roi, double* conf) const override
+    {
+      return classify(data, stride, roi, local_context(), conf);
+    }
+
+    virtual wchar_t classify(const uint8_t* data, int stride, const cv::Rect& roi,
+                             ClassifyContext& cctx, double* conf) const override
+    {
+      if (!data || roi.x < 0 || roi.y < 0 || roi.width <= 0 || roi.height <= 0 || stride < roi.x + roi.width)
+        throw invalid_parameters_exception("Invalid classify region.");
+      context* ctx = dynamic_cast<context*>(&cctx);
+      if (!ctx) throw invalid_parameters_exception("Classify context belongs to a different classifier size.");
+      const Model& model = snapshot(*ctx);
+      if (model.sets.empty())
       {
         if (conf) *conf = 0;
         return wchar_t(0);
       }
-      cv::Mat img = image;
-      if (img.cols != NSIZE || img.rows != NSIZE)
+      pack_query(data, stride, roi, *ctx);
+      wchar_t best_char;
+      double best_conf;
+      if (m_Cache.enabled() &&
+          m_Cache.lookup(ctx->rows, cache_aspect(*ctx), model.generation, best_char, best_conf))
       {
-        crop(img);
-        img = normalize(img);
+        if (conf) *conf = best_conf;
+        return best_char;
       }
-      Perimeter p(img);
-      std::multimap<double, wchar_t> score_map;
-      for (auto it = m_TS.begin(); it != m_TS.end();++it)
+      unsigned best;
+      best_char = classify_query(model, *ctx, best);
+      best_conf = score_from_distance<N>(best);
+      if (m_Cache.enabled()) m_Cache.insert(ctx->rows, cache_aspect(*ctx), model.generation, best_char, best_conf);
+      if (conf) *conf = best_conf;
+      return best_char;
+    }
+
+    virtual size_t classify_topk(const cv::Mat& image, size_t k, ClassScore* out) const override
+    {
+      check_image(image);
+      context& ctx = local_context();
+      const Model& model = snapshot(ctx);
+      if (model.sets.empty() || k == 0) return 0;
+      const perimeter& p = query_perimeter(image, ctx);
+      Prefilter pf = prefilter(ctx);
+      ScanCounters counters;
+      size_t n = scan_topk(model, p, pf, k, out, counters);
+      if (n == 0 && pf.active())
+        n = scan_topk(model, p, Prefilter(), k, out, counters);
+      flush(counters);
+      std::sort_heap(out, out + n, better);
+      return n;
+    }
+
+    virtual size_t classify_scores(const cv::Mat& image, float* per_class, size_t capacity,
+                                   wchar_t* chars) const override
+    {
+      check_image(image);
+      context& ctx = local_context();
+      const Model& model = snapshot(ctx);
+      size_t n = std::min(capacity, model.sets.size());
+      if (n == 0) return 0;
+      const perimeter& p = query_perimeter(image, ctx);
+      ScanCounters counters;
+      bool any = false;
+      for (Prefilter pf = prefilter(ctx); !any; pf = Prefilter())
       {
-        wchar_t c = it->first;
-        const pseq& s = it->second;
-        for(const auto& rp : s)
+        auto it = model.sets.begin();
+        for (size_t i = 0; i < n; ++it, ++i)
         {
-          double score = OpticMatch::match(p, rp, 4);
-          score_map.insert(std::make_pair(score, c));
+          unsigned d = UINT_MAX;
+          bool found = class_distance(p, *it->second, pf, d, counters);
+          per_class[i] = found ? float(score_from_distance<N>(d)) : 0.0f;
+          if (chars) chars[i] = it->first;
+          any = any || found;
         }
+        if (!pf.active()) break;
       }
-      if (conf) *conf = score_map.rbegin()->first;
-      return score_map.rbegin()->second;
+      flush(counters);
+      return n;
+    }
+
+    virtual size_t class_count() const override { return snapshot(local_context()).classes.size(); }
+
+    virtual wchar_t class_char(size_t index) const override
+    {
+      const Model& model = snapshot(local_context());
+      if (index >= model.classes.size()) throw invalid_parameters_exception("Class index out of range.");
+      return model.classes[index];
+    }
+
+    virtual CondenseStats condense(double tolerance, unsigned threads) override;
+
+    virtual ClassifierStats get_stats() const override
+    {
+      ClassifierStats stats;
+      stats.queries = m_Queries;
+      stats.templates_matched = m_Matched;
+      stats.templates_pruned = m_Pruned;
+      stats.templates_bounded = m_Bounded;
+      stats.prefilter_checked = m_Checked;
+      stats.prefilter_changed = m_Changed;
+      stats.index_searches = m_Searches;
+      stats.index_visited = m_Visited;
+      stats.templates_reversed = m_Reversed;
+      stats.templates_coarse = m_Coarse;
+      stats.cache_hits = m_Cache.hits;
+      stats.cache_misses = m_Cache.misses;
+      stats.cache_evictions = m_Cache.evictions;
+      // Holds the model while reading it, a writer may publish meanwhile
+      model_ptr model = std::atomic_load(&m_Model);
+      for (const auto& cls : model->sets)
+      {
+        stats.templates += cls.second->size();
+        for (size_t i = 0; i < cls.second->size(); ++i)
+          stats.training_samples += cls.second->multiplicity(i);
+      }
+      const EdtCheckStats& edt = edt_check_stats();
+      stats.edt_matrices = edt.matrices;
+      stats.edt_cells = edt.cells;
+      stats.edt_differing = edt.differing;
+      stats.edt_exact_worse = edt.exact_worse;
+      return stats;
+    }
+
+    virtual void reset_stats() override
+    {
+      m_Queries = 0;
+      m_Matched = 0;
+      m_Pruned = 0;
+      m_Bounded = 0;
+      m_Checked = 0;
+      m_Changed = 0;
+      m_Searches = 0;
+      m_Visited = 0;
+      m_Reversed = 0;
+      m_Coarse = 0;
+      m_Cache.reset_counters();
+    }
+
+    virtual void save(const std::string& path) const override;
+    virtual void load(const std::string& path) override;
+
+    virtual void classify_batch(const cv::Mat* images, size_t count,
+                                wchar_t* chars, double* confs,
+                                unsigned threads) const override
+    {
+      parallel_for(count, workers(threads), 16, [&](unsigned, size_t begin, size_t end)
+      {
+        for (size_t i = begin; i < end; ++i)
+          chars[i] = classify(images[i], confs ? &confs[i] : nullptr);
+      });
+    }
+
+    virtual void classify_batch(const uint8_t* data, int stride, const cv::Rect* rois, size_t count,
+                                wchar_t* chars, double* confs,
+                                unsigned threads) const override
+    {
+      parallel_for(count, workers(threads), 16, [&](unsigned, size_t begin, size_t end)
+      {
+        for (size_t i = begin; i < end; ++i)
+          chars[i] = classify(data, stride, rois[i], confs ? &confs[i] : nullptr);
+      });
     }
   };
 
+  // Samples are taken from the generator in chunks.  While the workers
+  // prepare one chunk, the calling thread generates the next, then the
+  // prepared chunk is merged in generator order.  The workers are started
+  // once for the whole call.
+  template<int N>
+  bool OpticMatchCharClassifier<N>::train(CharImageGenerator& cig, TrainStats* stats, unsigned threads)
+  {
+    typedef std::chrono::steady_clock clock;
+    auto seconds_since = [](clock::time_point t)
+    {
+      return std::chrono::duration<double>(clock::now() - t).count();
+    };
+    const size_t CHUNK = 256, BATCH = 8;
+    TrainStats ts;
+    auto start = clock::now();
+    std::lock_guard<std::mutex> lock(m_WriteLock);
+    std::shared_ptr<Model> m = draft();
+    std::vector<Sample> ready(CHUNK), next(CHUNK);
+    auto produce = [&](std::vector<Sample>& chunk)
+    {
+      auto t = clock::now();
+      size_t n = 0;
+      while (n < CHUNK && cig.generate(chunk[n].image, chunk[n].ch)) ++n;
+      ts.generate_seconds += seconds_since(t);
+      return n;
+    };
+    // Declared before the pool, whose destructor waits for running workers
+    const unsigned pool_size = resolve_thread_count(workers(threads), CHUNK / BATCH);
+    std::vector<clock::time_point> finished(pool_size);
+    WorkerPool pool(pool_size);
+    size_t count = produce(ready);
+    while (count > 0)
+    {
+      auto t = clock::now();
+      std::fill(finished.begin(), finished.end(), t);
+      pool.start(count, BATCH, [this, &m, &ready, &finished](unsigned worker, size_t begin, size_t end)
+      {
+        for (size_t i = begin; i < end; ++i)
+          prepare_sample(*m, ready[i]);
+        finished[worker] = clock::now();
+      });
+      size_t next_count = produce(next);
+      pool.wait();
+      ts.build_seconds += std::chrono::duration<double>(*std::max_element(finished.begin(), finished.end()) - t).count();
+      t = clock::now();
+      for (size_t i = 0; i < count; ++i)
+        if (merge_sample(*m, ready[i])) ++ts.templates_added;
+      ts.merge_seconds += seconds_since(t);
+      ts.samples += count;
+      ready.swap(next);
+      count = next_count;
+    }
+    publish(std::move(m));
+    ts.total_seconds = seconds_since(start);
+    if (stats) *stats = ts;
+    return ts.samples > 0;
+  }
+
+  // Hart's condensed nearest neighbour over the templates of all classes,
+  // using the classify distance: starting from the first template of each
+  // class, add every template the current prototypes misclassify until
+  // the training set is consistent.  Then, while the leave-one-out accuracy
+  // against the prototypes is more than tolerance below that of the full
+  // set, take the templates only the full set gets right and add their
+  // nearest same class template, as many as the accuracy is short of.
+  // Accuracies count every training sample, leaving out one sample of a
+  // template with multiplicity above one leaves the template itself.
+  template<int N>
+  CondenseStats OpticMatchCharClassifier<N>::condense(double tolerance, unsigned threads)
+  {
+    struct Item
+    {
+      wchar_t          ch;
+      const perimeter* p;
+      unsigned         mult;
+    };
+    std::lock_guard<std::mutex> lock(m_WriteLock);
+    model_ptr current = std::atomic_load(&m_Model);
+    std::vector<Item> items;
+    size_t samples = 0;
+    for (const auto& cls : current->sets)
+      for (size_t i = 0; i < cls.second->size(); ++i)
+      {
+        Item item = { cls.first, &cls.second->at(i), cls.second->multiplicity(i) };
+        items.push_back(item);
+        samples += item.mult;
+      }
+    const size_t n = items.size();
+    CondenseStats stats = { n, n, 0, 0 };
+    if (n == 0) return stats;
+
+    // Class of the nearest item in the set, other than the query itself
+    // unless it stands for more than one sample
+    auto nearest = [&](const std::vector<size_t>& set, size_t query, bool self)
+    {
+      unsigned best = UINT_MAX;
+      wchar_t best_char = wchar_t(0);
+      for (size_t i : set)
+      {
+        if (i == query && !self) continue;
+        unsigned d = distance(*items[query].p, *items[i].p, best);
+        if (d <= best)
+        {
+          best = d;
+          best_char = items[i].ch;
+        }
+      }
+      return best_char;
+    };
+    auto leave_one_out = [&](const std::vector<size_t>& set, std::vector<char>& correct)
+    {
+      std::vector<char> member(n, 0);
+      for (size_t i : set) member[i] = 1;
+      correct.assign(n, 0);
+      parallel_for(n, workers(threads), 16, [&](unsigned, size_t begin, size_t end)
+      {
+        for (size_t i = begin; i < end; ++i)
+          correct[i] = (nearest(set, i, member[i] && items[i].mult > 1) == items[i].ch);
+      });
+      size_t ok = 0;
+      for (size_t i = 0; i < n; ++i)
+        if (correct[i]) ok += items[i].mult;
+      return double(ok) / samples;
+    };
+
+    std::vector<size_t> all(n);
+    for (size_t i = 0; i < n; ++i) all[i] = i;
+    std::vector<char> full_correct, correct;
+    stats.loo_accuracy_before = leave_one_out(all, full_correct);
+
+    std::vector<char> kept(n, 0);
+    std::vector<size_t> set;
+    for (size_t i = 0; i < n; ++i)
+      if (i == 0 || items[i].ch != items[i - 1].ch)
+      {
+        kept[i] = 1;
+        set.push_back(i);
+      }
+    for (bool changed = true; changed;)
+    {
+      changed = false;
+      for (size_t i = 0; i < n; ++i)
+      {
+        if (kept[i] || nearest(set, i, false) == items[i].ch) continue;
+        kept[i] = 1;
+        set.push_back(i);
+        changed = true;
+      }
+    }
+    std::sort(set.begin(), set.end());
+
+    stats.loo_accuracy_after = leave_one_out(set, correct);
+    while (stats.loo_accuracy_after < stats.loo_accuracy_before - tolerance)
+    {
+      double missing = (stats.loo_accuracy_before - tolerance - stats.loo_accuracy_after) * samples;
+      size_t needed = std::max(size_t(1), size_t(std::ceil(missing)));
+      size_t added = 0;
+      for (size_t i = 0; i < n && added < needed; ++i)
+      {
+        if (correct[i] || !full_correct[i]) continue;
+        size_t add = i;
+        unsigned best = UINT_MAX;
+        for (size_t j = 0; j < n; ++j)
+        {
+          if (j == i || kept[j] || items[j].ch != items[i].ch) continue;
+          unsigned d = distance(*items[i].p, *items[j].p, best);
+          if (d <= best)
+          {
+            best = d;
+            add = j;
+          }
+        }
+        if (!kept[add])
+        {
+          kept[add] = 1;
+          ++added;
+        }
+      }
+      if (added == 0) break;
+      set.clear();
+      for (size_t i = 0; i < n; ++i)
+        if (kept[i]) set.push_back(i);
+      stats.loo_accuracy_after = leave_one_out(set, correct);
+    }
+
+    std::shared_ptr<Model> m = std::make_shared<Model>();
+    size_t k = 0;
+    for (const auto& cls : current->sets)
+    {
+      TemplateSet& s = m->writable(cls.first);
+      for (size_t i = 0; i < cls.second->size(); ++i, ++k)
+        if (kept[k])
+          s.add(cls.second->shared(i), cls.second->bitmap(i), cls.second->multiplicity(i), m_Config.interleave);
+    }
+    publish(std::move(m));
+    stats.templates_after = set.size();
+    return stats;
+  }
+
+  template<int N>
+  void OpticMatchCharClassifier<N>::save(const std::string& path) const
+  {
+    std::vector<ModelClass> classes;
+    std::vector<ModelTemplate> templates;
+    std::vector<uint32_t> bitmaps;
+    const size_t header_size = align_up(sizeof(ModelHeader));
+    size_t classes_size = 0, templates_size = 0, bitmaps_size = 0;
+    model_ptr model = std::atomic_load(&m_Model);
+    for (const auto& cls : model->sets)
+    {
+      const TemplateSet& s = *cls.second;
+      ModelClass mc = { uint32_t(cls.first), uint32_t(templates.size()), uint32_t(s.size()), 0 };
+      classes.push_back(mc);
+      for (size_t i = 0; i < s.size(); ++i)
+      {
+        const perimeter& p = s.at(i);
+        ModelTemplate mt = { 0, uint32_t(p.block_size()), p.point_count(), p.descriptor().aspect,
+                             s.multiplicity(i), uint32_t(p.format()), 0 };
+        templates.push_back(mt);
+        bitmaps.insert(bitmaps.end(), s.bitmap(i), s.bitmap(i) + N);
+      }
+    }
+    classes_size = align_up(classes.size() * sizeof(ModelClass));
+    templates_size = align_up(templates.size() * sizeof(ModelTemplate));
+    bitmaps_size = align_up(bitmaps.size() * sizeof(uint32_t));
+    uint64_t offset = header_size + classes_size + templates_size + bitmaps_size;
+    for (auto& mt : templates)
+    {
+      mt.offset = offset;
+      offset += align_up(mt.size);
+    }
+
+    ModelHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+    header.version = MODEL_VERSION;
+    header.endian = MODEL_ENDIAN;
+    header.grid = N;
+    header.class_count = uint32_t(classes.size());
+    header.template_count = uint32_t(templates.size());
+    header.classes_offset = header_size;
+    header.templates_offset = header_size + classes_size;
+    header.bitmaps_offset = header.templates_offset + templates_size;
+    header.file_size = offset;
+
+    // The model may be served from a mapping of path itself, so the new
+    // file is written next to it and then moved over it
+    std::string temp = path + ".tmp";
+    std::ofstream fout(temp.c_str(), std::ios::binary | std::ios::trunc);
+    if (fout.fail()) throw general_message_exception("Failed to create model file: " + temp);
+    const char padding[CACHE_LINE] = { 0 };
+    auto write_padded = [&](const void* data, size_t size)
+    {
+      fout.write(static_cast<const char*>(data), size);
+      fout.write(padding, align_up(size) - size);
+    };
+    write_padded(&header, sizeof(header));
+    if (!classes.empty()) write_padded(&classes[0], classes.size() * sizeof(ModelClass));
+    if (!templates.empty()) write_padded(&templates[0], templates.size() * sizeof(ModelTemplate));
+    if (!bitmaps.empty()) write_padded(&bitmaps[0], bitmaps.size() * sizeof(uint32_t));
+    for (const auto& cls : model->sets)
+      for (size_t i = 0; i < cls.second->size(); ++i)
+        write_padded(cls.second->at(i).block(), cls.second->at(i).block_size());
+    fout.close();
+    if (fout.fail())
+    {
+      std::remove(temp.c_str());
+      throw general_message_exception("Failed to write model file: " + temp);
+    }
+    replace_file(temp, path);
+  }
+
+  // Checks the file structure and, through Perimeter::from_block, every
+  // index stored in the template blocks.  A damaged file throws, but the
+  // distances are used as they are, so a file altered within those limits
+  // loads and classifies differently.
+  template<int N>
+  void OpticMatchCharClassifier<N>::load(const std::string& path)
+  {
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(path);
+    const byte* base = file->data();
+    size_t size = file->size();
+    auto fail = [&](const std::string& msg) { throw general_message_exception(msg + ": " + path); };
+    if (size < sizeof(ModelHeader)) fail("Not a model file");
+    const ModelHeader& header = *reinterpret_cast<const ModelHeader*>(base);
+    if (memcmp(header.magic, MODEL_MAGIC, sizeof(header.magic)) != 0) fail("Not a model file");
+    if (header.endian != MODEL_ENDIAN) fail("Model file byte order does not match");
+    if (header.version != MODEL_VERSION) fail("Unsupported model file version");
+    if (header.grid != uint32_t(N)) fail("Model grid size does not match the classifier");
+    // Whether bytes from offset lie within the file, without overflowing
+    auto within = [size](uint64_t offset, uint64_t bytes) { return offset <= size && bytes <= size - offset; };
+    if (header.file_size != size ||
+        !within(header.classes_offset, uint64_t(header.class_count) * sizeof(ModelClass)) ||
+        !within(header.templates_offset, uint64_t(header.template_count) * sizeof(ModelTemplate)) ||
+        !within(header.bitmaps_offset, uint64_t(header.template_count) * N * sizeof(uint32_t)))
+      fail("Model file is truncated");
+    if (header.classes_offset % CACHE_LINE != 0 || header.templates_offset % CACHE_LINE != 0 ||
+        header.bitmaps_offset % CACHE_LINE != 0)
+      fail("Model file is corrupt");
+
+    const ModelClass* classes = reinterpret_cast<const ModelClass*>(base + header.classes_offset);
+    const ModelTemplate* templates = reinterpret_cast<const ModelTemplate*>(base + header.templates_offset);
+    const uint32_t* bitmaps = reinterpret_cast<const uint32_t*>(base + header.bitmaps_offset);
+    std::shared_ptr<Model> m = std::make_shared<Model>();
+    for (uint32_t i = 0; i < header.class_count; ++i)
+    {
+      const ModelClass& mc = classes[i];
+      if (uint64_t(mc.first_template) + mc.template_count > header.template_count) fail("Model file is corrupt");
+      TemplateSet& s = m->writable(wchar_t(mc.ch));
+      for (uint32_t j = 0; j < mc.template_count; ++j)
+      {
+        const ModelTemplate& mt = templates[mc.first_template + j];
+        if (mt.offset % CACHE_LINE != 0 || !within(mt.offset, mt.size) || mt.point_count > uint32_t(N*N) ||
+            mt.multiplicity == 0 || mt.format > PLANES_LEAN ||
+            (mt.format == PLANES_COMPACT && mt.point_count > 256))
+          fail("Model file is corrupt");
+        perimeter p = perimeter::from_block(base + mt.offset, mt.size, mt.point_count, file, mt.aspect,
+                                            PlaneFormat(mt.format));
+        convert_planes(p);
+        s.add(std::make_shared<const perimeter>(std::move(p)), bitmaps + size_t(mc.first_template + j) * N, mt.multiplicity, m_Config.interleave);
+      }
+    }
+    std::lock_guard<std::mutex> lock(m_WriteLock);
+    publish(std::move(m));
+  }
+
+  template class Perimeter<16>;
+  template class Perimeter<24>;
+  template class Perimeter<32>;
+  template class OpticMatchCharClassifier<16>;
+  template class OpticMatchCharClassifier<24>;
+  template class OpticMatchCharClassifier<32>;
+
+  EdtCheckStats& edt_check_stats()
+  {
+    static EdtCheckStats stats;
+    return stats;
+  }
+
   std::shared_ptr<CharClassifier> CharClassifier::create(const std::string& params)
   {
-    CharClassifier* cls = new OpticMatchCharClassifier;
+    ClassifierConfig cfg;
+    if (!params.empty())
+    {
+      xml_ptr root = load_xml_from_text(params);
+      if (!root) throw invalid_parameters_exception("Invalid classifier parameters: " + params);
+      cfg.load_from_xml(root);
+    }
+    CharClassifier* cls = nullptr;
+    switch (cfg.size)
+    {
+    case 16: cls = new OpticMatchCharClassifier<16>(cfg); break;
+    case 24: cls = new OpticMatchCharClassifier<24>(cfg); break;
+    case 32: cls = new OpticMatchCharClassifier<32>(cfg); break;
+    default: throw invalid_parameters_exception("Unsupported glyph size, use 16, 24 or 32.");
+    }
     return std::shared_ptr<CharClassifier>(cls);
   }
 
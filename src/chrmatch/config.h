@@ -0,0 +1,232 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+#ifndef H_CONFIG_OPTMATCH
+#define H_CONFIG_OPTMATCH
+
+#include <cstdlib>
+#include <cerrno>
+#include <cmath>
+#include <string>
+#include <optmatch/xml.h>
+#include <optmatch/exceptions.h>
+#include "kernels.h"
+#include "perimeter.h"
+
+namespace OpticMatch {
+
+  // ENGINE_REFERENCE normalizes glyphs with cv::resize and classifies by
+  // the full symmetric distance to every template with the scalar kernel,
+  // ignoring the speed options, to check the results of the optimized
+  // engine against.
+  enum Engine { ENGINE_OPTIMIZED, ENGINE_REFERENCE };
+
+  // Classifier settings, read from the params of CharClassifier::create:
+  //
+  //   <classifier size="24" engine="optimized" kernel="auto" transform="exact" threads="0"
+  //               thres="4" dest_thres="4"
+  //               prefilter="0.6" pixel_prefilter="0" prefilter_check="0" planes="full" interleave="0"
+  //               vptree="0" vptree_budget="0" cache="0" lazy="0" lazy_candidates="0"
+  //               coarse_margin="0"/>
+  struct ClassifierConfig
+  {
+    // Upper limits of the numeric attributes.  Squared distances on the
+    // largest grid stay far below MAX_DISTANCE.
+    enum { MAX_THREADS = 1024, MAX_DISTANCE = 65535, MAX_CACHE = 1 << 24 };
+
+    int    size;             // Normalized glyph grid size: 16, 24 or 32
+    Engine engine;           // optimized or reference
+    KernelVariant kernel;    // Match kernel: auto, scalar, sse42, avx2 or avx512, falling back to what the CPU supports
+    DistanceTransform transform;  // Template distance planes: exact, bfs or check
+    unsigned threads;        // Workers of train, condense and batches called with 0 threads, 0 for all cores
+    unsigned thres;          // Squared point distance matched for free
+    unsigned dest_thres;     // Points sharing a nearest cell before it is penalized
+    double prefilter;        // Maximal descriptor distance of matched templates, 0 disables
+    double pixel_prefilter;  // Maximal share of pixels differing from matched templates, 0 disables
+    bool   prefilter_check;  // Also classify without the prefilter and count changed results
+    PlaneFormat planes;      // Template plane storage: full, compact or lean
+    double lean_share;       // Lean templates keep combinations used by this share of their points
+    bool   interleave;       // Keep interleaved template blocks to bound forward distances
+    bool   vptree;           // Search trained templates through a vantage point tree
+    unsigned vptree_budget;  // Nodes compared per tree search, 0 for an exact search: the tree seeds a full bounded scan
+    unsigned cache;          // Classify results cached by normalized glyph, 0 disables
+    bool   lazy;             // Match query points on all templates before building the query's planes
+    unsigned lazy_candidates;  // Templates matched on the query's planes, 0 for all (exact)
+    double coarse_margin;    // Squared grid distance per subsampled point allowed over the best subsample match, 0 disables (approximate)
+
+    ClassifierConfig()
+      : size(24)
+      , engine(ENGINE_OPTIMIZED)
+      , kernel(KERNEL_AUTO)
+      , transform(DT_EXACT)
+      , threads(0)
+      , thres(THRES)
+      , dest_thres(DEST_THRES)
+      , prefilter(0)
+      , pixel_prefilter(0)
+      , prefilter_check(false)
+      , planes(PLANES_FULL)
+      , lean_share(0.1)
+      , interleave(false)
+      , vptree(false)
+      , vptree_budget(0)
+      , cache(0)
+      , lazy(false)
+      , lazy_candidates(0)
+      , coarse_margin(0)
+    {}
+
+    // Integer attribute in [0, max_value].  Numbers are checked as strictly
+    // as names: anything else throws.
+    static unsigned read_unsigned(xml_ptr root, const char* name, unsigned max_value)
+    {
+      std::string text = root->get_attribute(name);
+      const char* begin = text.c_str();
+      char* end;
+      errno = 0;
+      long long value = strtoll(begin, &end, 10);
+      if (end == begin || *end != '\0' || errno == ERANGE || value < 0 || value > (long long)max_value)
+        throw invalid_parameters_exception("Invalid " + std::string(name) + ": " + text);
+      return unsigned(value);
+    }
+
+    // Number attribute in [min_value, max_value]
+    static double read_double(xml_ptr root, const char* name, double min_value, double max_value)
+    {
+      std::string text = root->get_attribute(name);
+      const char* begin = text.c_str();
+      char* end;
+      errno = 0;
+      double value = strtod(begin, &end);
+      if (end == begin || *end != '\0' || errno == ERANGE || !(value >= min_value && value <= max_value))
+        throw invalid_parameters_exception("Invalid " + std::string(name) + ": " + text);
+      return value;
+    }
+
+    static bool read_flag(xml_ptr root, const char* name)
+    {
+      return read_unsigned(root, name, 1) != 0;
+    }
+
+    void load_from_xml(xml_ptr root)
+    {
+      if (root->has_attribute("size"))
+        size = int(read_unsigned(root, "size", MAX_GRID));
+      if (root->has_attribute("engine"))
+      {
+        std::string name = root->get_attribute("engine");
+        if (name == "optimized") engine = ENGINE_OPTIMIZED;
+        else
+        if (name == "reference") engine = ENGINE_REFERENCE;
+        else
+          throw invalid_parameters_exception("Unknown engine: " + name);
+      }
+      if (root->has_attribute("kernel"))
+      {
+        std::string name = root->get_attribute("kernel");
+        if (name == "auto") kernel = KERNEL_AUTO;
+        else
+        if (name == "scalar") kernel = KERNEL_SCALAR;
+        else
+        if (name == "sse42") kernel = KERNEL_SSE42;
+        else
+        if (name == "avx2") kernel = KERNEL_AVX2;
+        else
+        if (name == "avx512") kernel = KERNEL_AVX512;
+        else
+          throw invalid_parameters_exception("Unknown match kernel: " + name);
+      }
+      if (root->has_attribute("transform"))
+      {
+        std::string name = root->get_attribute("transform");
+        if (name == "exact") transform = DT_EXACT;
+        else
+        if (name == "bfs") transform = DT_BFS;
+        else
+        if (name == "check") transform = DT_CHECK;
+        else
+          throw invalid_parameters_exception("Unknown distance transform: " + name);
+      }
+      if (root->has_attribute("threads"))
+        threads = read_unsigned(root, "threads", MAX_THREADS);
+      if (root->has_attribute("thres"))
+        thres = read_unsigned(root, "thres", MAX_DISTANCE);
+      if (root->has_attribute("dest_thres"))
+        dest_thres = read_unsigned(root, "dest_thres", 255);
+      if (root->has_attribute("prefilter"))
+        prefilter = read_double(root, "prefilter", 0, 1);
+      if (root->has_attribute("pixel_prefilter"))
+        pixel_prefilter = read_double(root, "pixel_prefilter", 0, 1);
+      if (root->has_attribute("prefilter_check"))
+        prefilter_check = read_flag(root, "prefilter_check");
+      if (root->has_attribute("planes"))
+      {
+        std::string name = root->get_attribute("planes");
+        if (name == "full") planes = PLANES_FULL;
+        else
+        if (name == "compact") planes = PLANES_COMPACT;
+        else
+        if (name == "lean") planes = PLANES_LEAN;
+        else
+          throw invalid_parameters_exception("Unknown plane format: " + name);
+      }
+      if (root->has_attribute("interleave"))
+        interleave = read_flag(root, "interleave");
+      if (root->has_attribute("vptree"))
+        vptree = read_flag(root, "vptree");
+      if (root->has_attribute("vptree_budget"))
+        vptree_budget = read_unsigned(root, "vptree_budget", UINT_MAX);
+      if (root->has_attribute("cache"))
+        cache = read_unsigned(root, "cache", MAX_CACHE);
+      if (root->has_attribute("lazy"))
+        lazy = read_flag(root, "lazy");
+      if (root->has_attribute("lazy_candidates"))
+        lazy_candidates = read_unsigned(root, "lazy_candidates", UINT_MAX);
+      if (root->has_attribute("coarse_margin"))
+        coarse_margin = read_double(root, "coarse_margin", 0, MAX_DISTANCE);
+      if (root->has_attribute("lean_share"))
+        lean_share = read_double(root, "lean_share", 0, 1);
+      if (engine == ENGINE_REFERENCE)
+      {
+        kernel = KERNEL_SCALAR;
+        prefilter = 0;
+        pixel_prefilter = 0;
+        prefilter_check = false;
+        planes = PLANES_FULL;
+        interleave = false;
+        vptree = false;
+        cache = 0;
+        lazy = false;
+        coarse_margin = 0;
+      }
+      // Compact planes and interleaved blocks saturate distances to 255
+      if (thres >= 255 && (planes == PLANES_COMPACT || interleave))
+        throw invalid_parameters_exception("thres must be below 255 with compact planes or interleave.");
+    }
+  };
+
+} // namespace OpticMatch
+
+#endif // H_CONFIG_OPTMATCH
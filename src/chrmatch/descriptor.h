@@ -0,0 +1,90 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+#ifndef H_DESCRIPTOR_OPTMATCH
+#define H_DESCRIPTOR_OPTMATCH
+
+#include <cmath>
+#include <cstdlib>
+
+namespace OpticMatch {
+
+  // Cheap global shape summary of a glyph, compared before running the full
+  // perimeter match so that clearly different templates can be skipped.
+  struct GlyphDescriptor
+  {
+    enum { ZONES = 4 };
+
+    float          aspect;                // Width / height before normalization, 0 if unknown
+    unsigned short points;                // Perimeter point count
+    unsigned short directions[4];         // Points having each gradient bit
+    unsigned short zones[ZONES * ZONES];  // Points in each cell of a coarse grid
+
+    GlyphDescriptor()
+      : aspect(0)
+      , points(0)
+    {
+      for (int i = 0; i < 4; ++i) directions[i] = 0;
+      for (int i = 0; i < ZONES*ZONES; ++i) zones[i] = 0;
+    }
+
+    template<class POINT_ITERATOR>
+    void compute(POINT_ITERATOR b, POINT_ITERATOR e, int grid)
+    {
+      *this = GlyphDescriptor();
+      for (; b != e; ++b)
+      {
+        ++points;
+        for (int i = 0; i < 4; ++i)
+          if (b->g() & (1 << i)) ++directions[i];
+        ++zones[(b->y() * ZONES / grid) * ZONES + b->x() * ZONES / grid];
+      }
+    }
+  };
+
+  // Weighted L1 distance between descriptors.  Each term is normalized to
+  // about [0,1], so a threshold around 0.5 only prunes very different shapes.
+  // The aspect term is skipped when either aspect is unknown.
+  inline float descriptor_distance(const GlyphDescriptor& a, const GlyphDescriptor& b)
+  {
+    float total = float(a.points + b.points);
+    if (total == 0) return 0;
+    float d = float(std::abs(int(a.points) - int(b.points))) / total;
+    int dir = 0;
+    for (int i = 0; i < 4; ++i)
+      dir += std::abs(int(a.directions[i]) - int(b.directions[i]));
+    d += 0.5f * float(dir) / total;
+    int zones = 0;
+    for (int i = 0; i < GlyphDescriptor::ZONES*GlyphDescriptor::ZONES; ++i)
+      zones += std::abs(int(a.zones[i]) - int(b.zones[i]));
+    d += 0.5f * float(zones) / total;
+    if (a.aspect > 0 && b.aspect > 0)
+      d += 0.5f * std::fabs(std::log(a.aspect / b.aspect));
+    return d;
+  }
+
+} // namespace OpticMatch
+
+#endif // H_DESCRIPTOR_OPTMATCH
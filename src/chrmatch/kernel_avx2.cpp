@@ -0,0 +1,213 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+// Compiled with AVX2 code generation enabled, only called after a CPUID check.
+#include "kernels.h"
+
+#ifdef OPTMATCH_X86_KERNELS
+
+#include <immintrin.h>
+
+namespace OpticMatch {
+
+  // Unsigned a > b in each lane, as a != min(a, b).  thres is unsigned and
+  // a signed compare would take thresholds from 2^31 up as negative.
+  static inline __m256i greater_epu32(__m256i a, __m256i b)
+  {
+    return _mm256_xor_si256(_mm256_cmpeq_epi32(_mm256_min_epu32(a, b), a), _mm256_set1_epi32(-1));
+  }
+
+  static unsigned match_compact_avx2(const MatchPlanes& m, const unsigned short* offsets, unsigned count,
+                                     unsigned thres, unsigned dest_thres, unsigned bound)
+  {
+    unsigned cells[MAX_GRID*MAX_GRID];
+    unsigned n = 0;
+    alignas(32) unsigned lanes[8];
+    const __m256i vthres = _mm256_set1_epi32(int(thres));
+    const __m256i low8 = _mm256_set1_epi32(0xFF);
+    const int* dist = reinterpret_cast<const int*>(m.dist8);
+    const int* near_index = reinterpret_cast<const int*>(m.near_index);
+    unsigned sum = 0, i = 0;
+    for (; (i + 8) <= count; i += 8)
+    {
+      __m256i idx = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(offsets + i)));
+      __m256i d = _mm256_and_si256(_mm256_i32gather_epi32(dist, idx, 1), low8);
+      __m256i over = greater_epu32(d, vthres);
+      unsigned mask = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(over)));
+      if (mask == 0) continue;
+      __m256i sel = _mm256_and_si256(d, over);
+      __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sel), _mm256_extracti128_si256(sel, 1));
+      s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+      s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+      sum += unsigned(_mm_cvtsi128_si32(s));
+      __m256i near = _mm256_and_si256(_mm256_mask_i32gather_epi32(_mm256_setzero_si256(), near_index, idx, over, 1), low8);
+      _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), near);
+      for (unsigned lane = 0; lane < 8; ++lane)
+      {
+        cells[n] = lanes[lane];
+        n += (mask >> lane) & 1;
+      }
+      if (sum > bound) return sum;
+    }
+    sum = collect_points_compact(m, offsets, i, count, thres, bound, sum, cells, n);
+    if (sum > bound) return sum;
+    return add_cell_penalties(sum, cells, n, dest_thres);
+  }
+
+  // Lanes whose gradient combination has no stored plane start above any
+  // distance and take the minimum over the base planes in their gradient.
+  static unsigned match_lean_avx2(const MatchPlanes& m, const unsigned short* offsets, unsigned count,
+                                  unsigned thres, unsigned dest_thres, unsigned bound)
+  {
+    unsigned cells[MAX_GRID*MAX_GRID];
+    unsigned n = 0;
+    alignas(32) unsigned lanes[8];
+    const unsigned plane_size = m.grid * m.grid;
+    const __m256i vthres = _mm256_set1_epi32(int(thres));
+    const __m256i vgrid = _mm256_set1_epi32(int(m.grid));
+    const __m256i vsize = _mm256_set1_epi32(int(plane_size));
+    const __m256i vmagic = _mm256_set1_epi32(int(plane_magic(plane_size)));
+    const __m256i vcombine = _mm256_set1_epi32(LEAN_COMBINE);
+    const __m256i vfar = _mm256_set1_epi32(INT_MAX);
+    const __m256i low16 = _mm256_set1_epi32(0xFFFF);
+    const __m256i low8 = _mm256_set1_epi32(0xFF);
+    const int* dist = reinterpret_cast<const int*>(m.dist);
+    const int* near_x = reinterpret_cast<const int*>(m.near_x);
+    const int* near_y = reinterpret_cast<const int*>(m.near_y);
+    const int* slots = reinterpret_cast<const int*>(m.plane_slot);
+    unsigned sum = 0, i = 0;
+    for (; (i + 8) <= count; i += 8)
+    {
+      __m256i idx = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(offsets + i)));
+      __m256i g = _mm256_srli_epi32(_mm256_mullo_epi32(idx, vmagic), 24);
+      __m256i pos = _mm256_sub_epi32(idx, _mm256_mullo_epi32(g, vsize));
+      __m256i slot = _mm256_and_si256(_mm256_i32gather_epi32(slots, g, 1), low8);
+      __m256i combine = _mm256_cmpeq_epi32(slot, vcombine);
+      __m256i at = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_andnot_si256(combine, slot), vsize), pos);
+      __m256i direct = _mm256_xor_si256(combine, _mm256_set1_epi32(-1));
+      __m256i d = _mm256_and_si256(_mm256_mask_i32gather_epi32(_mm256_setzero_si256(), dist, at, direct, 2), low16);
+      d = _mm256_or_si256(d, _mm256_and_si256(combine, vfar));
+      if (_mm256_movemask_ps(_mm256_castsi256_ps(combine)))
+      {
+        for (int b = 0; b < 4; ++b)
+        {
+          __m256i bit = _mm256_set1_epi32(1 << b);
+          __m256i has = _mm256_and_si256(combine, _mm256_cmpeq_epi32(_mm256_and_si256(g, bit), bit));
+          if (!_mm256_movemask_ps(_mm256_castsi256_ps(has))) continue;
+          __m256i o = _mm256_add_epi32(_mm256_set1_epi32(b * int(plane_size)), pos);
+          __m256i cd = _mm256_and_si256(_mm256_mask_i32gather_epi32(_mm256_setzero_si256(), dist, o, has, 2), low16);
+          __m256i take = _mm256_and_si256(has, _mm256_cmpgt_epi32(d, cd));
+          d = _mm256_blendv_epi8(d, cd, take);
+          at = _mm256_blendv_epi8(at, o, take);
+        }
+      }
+      __m256i over = greater_epu32(d, vthres);
+      unsigned mask = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(over)));
+      if (mask == 0) continue;
+      __m256i sel = _mm256_and_si256(d, over);
+      __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sel), _mm256_extracti128_si256(sel, 1));
+      s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+      s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+      sum += unsigned(_mm_cvtsi128_si32(s));
+      __m256i nx = _mm256_and_si256(_mm256_mask_i32gather_epi32(_mm256_setzero_si256(), near_x, at, over, 1), low8);
+      __m256i ny = _mm256_and_si256(_mm256_mask_i32gather_epi32(_mm256_setzero_si256(), near_y, at, over, 1), low8);
+      _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), _mm256_add_epi32(_mm256_mullo_epi32(ny, vgrid), nx));
+      for (unsigned lane = 0; lane < 8; ++lane)
+      {
+        cells[n] = lanes[lane];
+        n += (mask >> lane) & 1;
+      }
+      if (sum > bound) return sum;
+    }
+    sum = collect_points_lean(m, offsets, i, count, thres, bound, sum, cells, n);
+    if (sum > bound) return sum;
+    return add_cell_penalties(sum, cells, n, dest_thres);
+  }
+
+  unsigned match_kernel_avx2(const MatchPlanes& m, const unsigned short* offsets, unsigned count,
+                             unsigned thres, unsigned dest_thres, unsigned bound)
+  {
+    if (m.format == PLANES_COMPACT) return match_compact_avx2(m, offsets, count, thres, dest_thres, bound);
+    if (m.format == PLANES_LEAN) return match_lean_avx2(m, offsets, count, thres, dest_thres, bound);
+    unsigned cells[MAX_GRID*MAX_GRID];
+    unsigned n = 0;
+    alignas(32) unsigned lanes[8];
+    const __m256i vthres = _mm256_set1_epi32(int(thres));
+    const __m256i vgrid = _mm256_set1_epi32(int(m.grid));
+    const __m256i low16 = _mm256_set1_epi32(0xFFFF);
+    const __m256i low8 = _mm256_set1_epi32(0xFF);
+    const int* dist = reinterpret_cast<const int*>(m.dist);
+    const int* near_x = reinterpret_cast<const int*>(m.near_x);
+    const int* near_y = reinterpret_cast<const int*>(m.near_y);
+    unsigned sum = 0, i = 0;
+    for (; (i + 8) <= count; i += 8)
+    {
+      __m256i idx = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(offsets + i)));
+      __m256i d = _mm256_and_si256(_mm256_i32gather_epi32(dist, idx, 2), low16);
+      __m256i over = greater_epu32(d, vthres);
+      unsigned mask = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(over)));
+      if (mask == 0) continue;
+      __m256i sel = _mm256_and_si256(d, over);
+      __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sel), _mm256_extracti128_si256(sel, 1));
+      s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+      s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+      sum += unsigned(_mm_cvtsi128_si32(s));
+      __m256i nx = _mm256_and_si256(_mm256_mask_i32gather_epi32(_mm256_setzero_si256(), near_x, idx, over, 1), low8);
+      __m256i ny = _mm256_and_si256(_mm256_mask_i32gather_epi32(_mm256_setzero_si256(), near_y, idx, over, 1), low8);
+      _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), _mm256_add_epi32(_mm256_mullo_epi32(ny, vgrid), nx));
+      // Branch free append of the selected lanes
+      for (unsigned lane = 0; lane < 8; ++lane)
+      {
+        cells[n] = lanes[lane];
+        n += (mask >> lane) & 1;
+      }
+      if (sum > bound) return sum;
+    }
+    sum = collect_points(m, offsets, i, count, thres, bound, sum, cells, n);
+    if (sum > bound) return sum;
+    return add_cell_penalties(sum, cells, n, dest_thres);
+  }
+
+  void block_kernel_avx2(const byte* block, const unsigned short* offsets, unsigned count,
+                         unsigned thres, unsigned* sums)
+  {
+    const __m256i vthres = _mm256_set1_epi32(int(thres));
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    for (unsigned i = 0; i < count; ++i)
+    {
+      __m128i d8 = _mm_load_si128(reinterpret_cast<const __m128i*>(block + offsets[i] * BLOCK_WIDTH));
+      __m256i d0 = _mm256_cvtepu8_epi32(d8);
+      __m256i d1 = _mm256_cvtepu8_epi32(_mm_unpackhi_epi64(d8, d8));
+      acc0 = _mm256_add_epi32(acc0, _mm256_and_si256(d0, greater_epu32(d0, vthres)));
+      acc1 = _mm256_add_epi32(acc1, _mm256_and_si256(d1, greater_epu32(d1, vthres)));
+    }
+    __m256i* out = reinterpret_cast<__m256i*>(sums);
+    _mm256_storeu_si256(out, _mm256_add_epi32(_mm256_loadu_si256(out), acc0));
+    _mm256_storeu_si256(out + 1, _mm256_add_epi32(_mm256_loadu_si256(out + 1), acc1));
+  }
+
+} // namespace OpticMatch
+
+#endif // OPTMATCH_X86_KERNELS
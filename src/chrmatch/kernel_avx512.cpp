@@ -0,0 +1,156 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+// Compiled with AVX-512F code generation enabled, only called after a CPUID check.
+#include "kernels.h"
+
+#ifdef OPTMATCH_X86_KERNELS
+
+#include <immintrin.h>
+
+namespace OpticMatch {
+
+  static unsigned match_compact_avx512(const MatchPlanes& m, const unsigned short* offsets, unsigned count,
+                                       unsigned thres, unsigned dest_thres, unsigned bound)
+  {
+    unsigned cells[MAX_GRID*MAX_GRID];
+    unsigned n = 0;
+    const __m512i vthres = _mm512_set1_epi32(int(thres));
+    const __m512i low8 = _mm512_set1_epi32(0xFF);
+    unsigned sum = 0, i = 0;
+    for (; (i + 16) <= count; i += 16)
+    {
+      __m512i idx = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets + i)));
+      __m512i d = _mm512_and_si512(_mm512_i32gather_epi32(idx, m.dist8, 1), low8);
+      __mmask16 over = _mm512_cmpgt_epu32_mask(d, vthres);
+      if (over == 0) continue;
+      sum += unsigned(_mm512_mask_reduce_add_epi32(over, d));
+      __m512i near = _mm512_and_si512(_mm512_mask_i32gather_epi32(_mm512_setzero_si512(), over, idx, m.near_index, 1), low8);
+      _mm512_mask_compressstoreu_epi32(cells + n, over, near);
+      n += bit_count(over);
+      if (sum > bound) return sum;
+    }
+    sum = collect_points_compact(m, offsets, i, count, thres, bound, sum, cells, n);
+    if (sum > bound) return sum;
+    return add_cell_penalties(sum, cells, n, dest_thres);
+  }
+
+  // Lanes whose gradient combination has no stored plane start above any
+  // distance and take the minimum over the base planes in their gradient.
+  static unsigned match_lean_avx512(const MatchPlanes& m, const unsigned short* offsets, unsigned count,
+                                    unsigned thres, unsigned dest_thres, unsigned bound)
+  {
+    unsigned cells[MAX_GRID*MAX_GRID];
+    unsigned n = 0;
+    const unsigned plane_size = m.grid * m.grid;
+    const __m512i vthres = _mm512_set1_epi32(int(thres));
+    const __m512i vgrid = _mm512_set1_epi32(int(m.grid));
+    const __m512i vsize = _mm512_set1_epi32(int(plane_size));
+    const __m512i vmagic = _mm512_set1_epi32(int(plane_magic(plane_size)));
+    const __m512i vcombine = _mm512_set1_epi32(LEAN_COMBINE);
+    const __m512i vfar = _mm512_set1_epi32(INT_MAX);
+    const __m512i low16 = _mm512_set1_epi32(0xFFFF);
+    const __m512i low8 = _mm512_set1_epi32(0xFF);
+    unsigned sum = 0, i = 0;
+    for (; (i + 16) <= count; i += 16)
+    {
+      __m512i idx = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets + i)));
+      __m512i g = _mm512_srli_epi32(_mm512_mullo_epi32(idx, vmagic), 24);
+      __m512i pos = _mm512_sub_epi32(idx, _mm512_mullo_epi32(g, vsize));
+      __m512i slot = _mm512_and_si512(_mm512_i32gather_epi32(g, m.plane_slot, 1), low8);
+      __mmask16 combine = _mm512_cmpeq_epi32_mask(slot, vcombine);
+      __m512i at = _mm512_add_epi32(_mm512_mullo_epi32(slot, vsize), pos);
+      __m512i d = _mm512_and_si512(_mm512_mask_i32gather_epi32(vfar, __mmask16(~combine), at, m.dist, 2), low16);
+      d = _mm512_mask_mov_epi32(d, combine, vfar);
+      for (int b = 0; combine && b < 4; ++b)
+      {
+        __mmask16 has = _mm512_mask_test_epi32_mask(combine, g, _mm512_set1_epi32(1 << b));
+        if (!has) continue;
+        __m512i o = _mm512_add_epi32(_mm512_set1_epi32(b * int(plane_size)), pos);
+        __m512i cd = _mm512_and_si512(_mm512_mask_i32gather_epi32(vfar, has, o, m.dist, 2), low16);
+        __mmask16 take = _mm512_mask_cmplt_epu32_mask(has, cd, d);
+        d = _mm512_mask_mov_epi32(d, take, cd);
+        at = _mm512_mask_mov_epi32(at, take, o);
+      }
+      __mmask16 over = _mm512_cmpgt_epu32_mask(d, vthres);
+      if (over == 0) continue;
+      sum += unsigned(_mm512_mask_reduce_add_epi32(over, d));
+      __m512i nx = _mm512_and_si512(_mm512_mask_i32gather_epi32(_mm512_setzero_si512(), over, at, m.near_x, 1), low8);
+      __m512i ny = _mm512_and_si512(_mm512_mask_i32gather_epi32(_mm512_setzero_si512(), over, at, m.near_y, 1), low8);
+      _mm512_mask_compressstoreu_epi32(cells + n, over, _mm512_add_epi32(_mm512_mullo_epi32(ny, vgrid), nx));
+      n += bit_count(over);
+      if (sum > bound) return sum;
+    }
+    sum = collect_points_lean(m, offsets, i, count, thres, bound, sum, cells, n);
+    if (sum > bound) return sum;
+    return add_cell_penalties(sum, cells, n, dest_thres);
+  }
+
+  unsigned match_kernel_avx512(const MatchPlanes& m, const unsigned short* offsets, unsigned count,
+                               unsigned thres, unsigned dest_thres, unsigned bound)
+  {
+    if (m.format == PLANES_COMPACT) return match_compact_avx512(m, offsets, count, thres, dest_thres, bound);
+    if (m.format == PLANES_LEAN) return match_lean_avx512(m, offsets, count, thres, dest_thres, bound);
+    unsigned cells[MAX_GRID*MAX_GRID];
+    unsigned n = 0;
+    const __m512i vthres = _mm512_set1_epi32(int(thres));
+    const __m512i vgrid = _mm512_set1_epi32(int(m.grid));
+    const __m512i low16 = _mm512_set1_epi32(0xFFFF);
+    const __m512i low8 = _mm512_set1_epi32(0xFF);
+    unsigned sum = 0, i = 0;
+    for (; (i + 16) <= count; i += 16)
+    {
+      __m512i idx = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets + i)));
+      __m512i d = _mm512_and_si512(_mm512_i32gather_epi32(idx, m.dist, 2), low16);
+      __mmask16 over = _mm512_cmpgt_epu32_mask(d, vthres);
+      if (over == 0) continue;
+      sum += unsigned(_mm512_mask_reduce_add_epi32(over, d));
+      __m512i nx = _mm512_and_si512(_mm512_mask_i32gather_epi32(_mm512_setzero_si512(), over, idx, m.near_x, 1), low8);
+      __m512i ny = _mm512_and_si512(_mm512_mask_i32gather_epi32(_mm512_setzero_si512(), over, idx, m.near_y, 1), low8);
+      _mm512_mask_compressstoreu_epi32(cells + n, over, _mm512_add_epi32(_mm512_mullo_epi32(ny, vgrid), nx));
+      n += bit_count(over);
+      if (sum > bound) return sum;
+    }
+    sum = collect_points(m, offsets, i, count, thres, bound, sum, cells, n);
+    if (sum > bound) return sum;
+    return add_cell_penalties(sum, cells, n, dest_thres);
+  }
+
+  void block_kernel_avx512(const byte* block, const unsigned short* offsets, unsigned count,
+                           unsigned thres, unsigned* sums)
+  {
+    const __m512i vthres = _mm512_set1_epi32(int(thres));
+    __m512i acc = _mm512_setzero_si512();
+    for (unsigned i = 0; i < count; ++i)
+    {
+      __m512i d = _mm512_cvtepu8_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(block + offsets[i] * BLOCK_WIDTH)));
+      acc = _mm512_mask_add_epi32(acc, _mm512_cmpgt_epu32_mask(d, vthres), acc, d);
+    }
+    _mm512_storeu_si512(sums, _mm512_add_epi32(_mm512_loadu_si512(sums), acc));
+  }
+
+} // namespace OpticMatch
+
+#endif // OPTMATCH_X86_KERNELS
@@ -0,0 +1,105 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+// Compiled with SSE4.2 code generation enabled, only called after a CPUID check.
+#include "kernels.h"
+
+#ifdef OPTMATCH_X86_KERNELS
+
+#include <nmmintrin.h>
+
+namespace OpticMatch {
+
+  // Unsigned a > b in each lane, as a != min(a, b).  thres is unsigned and
+  // a signed compare would take thresholds from 2^31 up as negative.
+  static inline __m128i greater_epu32(__m128i a, __m128i b)
+  {
+    return _mm_xor_si128(_mm_cmpeq_epi32(_mm_min_epu32(a, b), a), _mm_set1_epi32(-1));
+  }
+
+  // No gather before AVX2, so the 4 distances and nearest cells are loaded
+  // one by one and only the threshold test and the summation are done in
+  // vector registers.  Compact and lean planes gain nothing from that over
+  // the scalar loop.
+  unsigned match_kernel_sse42(const MatchPlanes& m, const unsigned short* offsets, unsigned count,
+                              unsigned thres, unsigned dest_thres, unsigned bound)
+  {
+    if (m.format != PLANES_FULL) return match_kernel_scalar(m, offsets, count, thres, dest_thres, bound);
+    unsigned cells[MAX_GRID*MAX_GRID];
+    unsigned n = 0;
+    const unsigned short* dist = m.dist;
+    const __m128i vthres = _mm_set1_epi32(int(thres));
+    unsigned sum = 0, i = 0;
+    for (; (i + 4) <= count; i += 4)
+    {
+      const unsigned short* o = offsets + i;
+      __m128i d = _mm_setr_epi32(dist[o[0]], dist[o[1]], dist[o[2]], dist[o[3]]);
+      __m128i over = greater_epu32(d, vthres);
+      unsigned mask = unsigned(_mm_movemask_ps(_mm_castsi128_ps(over)));
+      if (mask == 0) continue;
+      __m128i s = _mm_and_si128(d, over);
+      s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+      s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+      sum += unsigned(_mm_cvtsi128_si32(s));
+      for (; mask; mask &= mask - 1)
+      {
+        unsigned offset = o[lowest_bit(mask)];
+        cells[n++] = m.near_y[offset] * m.grid + m.near_x[offset];
+      }
+      if (sum > bound) return sum;
+    }
+    sum = collect_points(m, offsets, i, count, thres, bound, sum, cells, n);
+    if (sum > bound) return sum;
+    return add_cell_penalties(sum, cells, n, dest_thres);
+  }
+
+  void block_kernel_sse42(const byte* block, const unsigned short* offsets, unsigned count,
+                          unsigned thres, unsigned* sums)
+  {
+    const __m128i vthres = _mm_set1_epi8(char(thres));
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc[4] = { zero, zero, zero, zero };
+    for (unsigned i = 0; i < count; ++i)
+    {
+      __m128i d = _mm_load_si128(reinterpret_cast<const __m128i*>(block + offsets[i] * BLOCK_WIDTH));
+      // Unsigned d > thres, as d != min(d, thres)
+      __m128i keep = _mm_xor_si128(_mm_cmpeq_epi8(_mm_min_epu8(d, vthres), d), _mm_set1_epi8(-1));
+      d = _mm_and_si128(d, keep);
+      __m128i lo = _mm_unpacklo_epi8(d, zero), hi = _mm_unpackhi_epi8(d, zero);
+      acc[0] = _mm_add_epi32(acc[0], _mm_unpacklo_epi16(lo, zero));
+      acc[1] = _mm_add_epi32(acc[1], _mm_unpackhi_epi16(lo, zero));
+      acc[2] = _mm_add_epi32(acc[2], _mm_unpacklo_epi16(hi, zero));
+      acc[3] = _mm_add_epi32(acc[3], _mm_unpackhi_epi16(hi, zero));
+    }
+    for (int j = 0; j < 4; ++j)
+    {
+      __m128i* out = reinterpret_cast<__m128i*>(sums + 4 * j);
+      _mm_storeu_si128(out, _mm_add_epi32(_mm_loadu_si128(out), acc[j]));
+    }
+  }
+
+} // namespace OpticMatch
+
+#endif // OPTMATCH_X86_KERNELS
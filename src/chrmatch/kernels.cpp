@@ -0,0 +1,161 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+#include "stdafx.h"
+#include "kernels.h"
+
+namespace OpticMatch {
+
+  unsigned match_kernel_scalar(const MatchPlanes& m, const unsigned short* offsets, unsigned count,
+                               unsigned thres, unsigned dest_thres, unsigned bound)
+  {
+    unsigned cells[MAX_GRID*MAX_GRID];
+    unsigned n = 0;
+    unsigned sum;
+    if (m.format == PLANES_COMPACT)
+      sum = collect_points_compact(m, offsets, 0, count, thres, bound, 0, cells, n);
+    else
+    if (m.format == PLANES_LEAN)
+      sum = collect_points_lean(m, offsets, 0, count, thres, bound, 0, cells, n);
+    else
+      sum = collect_points(m, offsets, 0, count, thres, bound, 0, cells, n);
+    if (sum > bound) return sum;
+    return add_cell_penalties(sum, cells, n, dest_thres);
+  }
+
+  void block_kernel_scalar(const byte* block, const unsigned short* offsets, unsigned count,
+                           unsigned thres, unsigned* sums)
+  {
+    for (unsigned i = 0; i < count; ++i)
+    {
+      const byte* d = block + offsets[i] * BLOCK_WIDTH;
+      for (unsigned t = 0; t < BLOCK_WIDTH; ++t)
+        if (d[t] > thres) sums[t] += d[t];
+    }
+  }
+
+#ifdef OPTMATCH_X86_KERNELS
+
+#ifdef _MSC_VER
+  static bool cpu_has(KernelVariant variant)
+  {
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+    __cpuid(info, 1);
+    bool sse42 = (info[2] & (1 << 20)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (variant == KERNEL_SSE42) return sse42;
+    if (!osxsave || !avx || max_leaf < 7) return false;
+    unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    if (variant == KERNEL_AVX2)
+      return (xcr0 & 0x6) == 0x6 && (info[1] & (1 << 5)) != 0;
+    if (variant == KERNEL_AVX512)
+      return (xcr0 & 0xE6) == 0xE6 && (info[1] & (1 << 16)) != 0;
+    return false;
+  }
+#else
+  static bool cpu_has(KernelVariant variant)
+  {
+    __builtin_cpu_init();
+    switch (variant)
+    {
+    case KERNEL_SSE42:  return __builtin_cpu_supports("sse4.2") != 0;
+    case KERNEL_AVX2:   return __builtin_cpu_supports("avx2") != 0;
+    case KERNEL_AVX512: return __builtin_cpu_supports("avx512f") != 0;
+    default:            return false;
+    }
+  }
+#endif
+
+  static KernelVariant detect_kernel_variant()
+  {
+    if (cpu_has(KERNEL_AVX512)) return KERNEL_AVX512;
+    if (cpu_has(KERNEL_AVX2))   return KERNEL_AVX2;
+    if (cpu_has(KERNEL_SSE42))  return KERNEL_SSE42;
+    return KERNEL_SCALAR;
+  }
+
+#else
+
+  static KernelVariant detect_kernel_variant()
+  {
+    return KERNEL_SCALAR;
+  }
+
+#endif // OPTMATCH_X86_KERNELS
+
+  KernelVariant supported_kernel_variant()
+  {
+    static const KernelVariant variant = detect_kernel_variant();
+    return variant;
+  }
+
+  match_kernel select_match_kernel(KernelVariant variant)
+  {
+    KernelVariant best = supported_kernel_variant();
+    if (variant == KERNEL_AUTO || variant > best) variant = best;
+    switch (variant)
+    {
+#ifdef OPTMATCH_X86_KERNELS
+    case KERNEL_AVX512: return match_kernel_avx512;
+    case KERNEL_AVX2:   return match_kernel_avx2;
+    case KERNEL_SSE42:  return match_kernel_sse42;
+#endif
+    default:            return match_kernel_scalar;
+    }
+  }
+
+  block_kernel select_block_kernel(KernelVariant variant)
+  {
+    KernelVariant best = supported_kernel_variant();
+    if (variant == KERNEL_AUTO || variant > best) variant = best;
+    switch (variant)
+    {
+#ifdef OPTMATCH_X86_KERNELS
+    case KERNEL_AVX512: return block_kernel_avx512;
+    case KERNEL_AVX2:   return block_kernel_avx2;
+    case KERNEL_SSE42:  return block_kernel_sse42;
+#endif
+    default:            return block_kernel_scalar;
+    }
+  }
+
+  const char* kernel_variant_name(KernelVariant variant)
+  {
+    switch (variant)
+    {
+    case KERNEL_AUTO:   return "auto";
+    case KERNEL_SCALAR: return "scalar";
+    case KERNEL_SSE42:  return "sse42";
+    case KERNEL_AVX2:   return "avx2";
+    case KERNEL_AVX512: return "avx512";
+    }
+    return "unknown";
+  }
+
+} // namespace OpticMatch
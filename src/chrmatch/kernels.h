@@ -0,0 +1,274 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+#ifndef H_KERNELS_OPTMATCH
+#define H_KERNELS_OPTMATCH
+
+#include <cstring>
+#include <climits>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace OpticMatch {
+
+  typedef unsigned char byte;
+
+  // Largest glyph grid the match kernels support
+  const unsigned MAX_GRID = 32;
+
+  // Vector kernels use 32 bit gathers, so this many bytes past the end of
+  // the planes must be readable.
+  const unsigned GATHER_SLACK = 4;
+
+  // How a perimeter stores its planes.  PLANES_COMPACT keeps the squared
+  // distances saturated to 255 and, instead of the coordinates of the
+  // nearest point, its index in the perimeter's point list, which needs at
+  // most 256 points.  The index identifies the nearest point as well as its
+  // cell does, so only the saturation changes match results.
+  // PLANES_LEAN keeps full precision but stores only the four single
+  // direction planes and some of the combinations, plane_slot maps each
+  // gradient combination to its stored plane or LEAN_COMBINE.  The others
+  // are the minimum over their base planes, taken in LEFT, TOP, RIGHT,
+  // BOTTOM order with earlier planes winning ties, as Perimeter builds them,
+  // so lean planes give the same results as full ones.
+  enum PlaneFormat { PLANES_FULL, PLANES_COMPACT, PLANES_LEAN };
+
+  const byte LEAN_COMBINE = 0xFF;
+
+  // Flat view of a perimeter's distance planes, see Perimeter for the layout.
+  struct MatchPlanes
+  {
+    const unsigned short* dist;
+    const byte*           near_x;
+    const byte*           near_y;
+    unsigned              grid;
+    PlaneFormat           format;
+    const byte*           dist8;       // PLANES_COMPACT only
+    const byte*           near_index;  // PLANES_COMPACT only
+    const byte*           plane_slot;  // PLANES_LEAN only, 16 entries, readable up to 64 bytes
+  };
+
+  // Multiplier turning offset / plane_size into (offset * magic) >> 24 for
+  // any offset in 16 planes of up to MAX_GRID x MAX_GRID.
+  static inline unsigned plane_magic(unsigned plane_size)
+  {
+    return (1U << 24) / plane_size + 1;
+  }
+
+  // Sums the squared distances, above thres, of the points whose plane
+  // offsets are given, plus the penalty for points sharing a nearest cell
+  // more than dest_thres times.  The penalty for a cell depends only on its
+  // final count, so it is added after the distances and all kernels return
+  // the same value regardless of the order in which they visit the points.
+  // Once the sum exceeds bound the kernel may stop and return any value
+  // greater than bound.
+  typedef unsigned (*match_kernel)(const MatchPlanes& planes, const unsigned short* offsets,
+                                   unsigned count, unsigned thres, unsigned dest_thres,
+                                   unsigned bound);
+
+  // Templates per interleaved block.  A block holds, for every plane
+  // offset o, the distances of its templates saturated to 255 in bytes
+  // [o*BLOCK_WIDTH, (o+1)*BLOCK_WIDTH).
+  const unsigned BLOCK_WIDTH = 16;
+
+  // Adds to sums[t], for each template t of an interleaved block, its
+  // distances above thres at the given offsets.  Without the shared cell
+  // penalty and with saturated distances this is a lower bound of the
+  // forward match distance of each template.  The distances are bytes,
+  // so thres must be at most 255.
+  typedef void (*block_kernel)(const byte* block, const unsigned short* offsets, unsigned count,
+                               unsigned thres, unsigned* sums);
+
+  enum KernelVariant
+  {
+    KERNEL_AUTO,
+    KERNEL_SCALAR,
+    KERNEL_SSE42,
+    KERNEL_AVX2,
+    KERNEL_AVX512
+  };
+
+  // Returns the requested kernel, or the best one supported by the CPU
+  // not above it.  KERNEL_AUTO picks the best supported kernel.
+  match_kernel select_match_kernel(KernelVariant variant = KERNEL_AUTO);
+  block_kernel select_block_kernel(KernelVariant variant = KERNEL_AUTO);
+  KernelVariant supported_kernel_variant();
+  const char* kernel_variant_name(KernelVariant variant);
+
+  unsigned match_kernel_scalar(const MatchPlanes&, const unsigned short*, unsigned, unsigned, unsigned, unsigned);
+  void block_kernel_scalar(const byte*, const unsigned short*, unsigned, unsigned, unsigned*);
+#ifdef OPTMATCH_X86_KERNELS
+  unsigned match_kernel_sse42(const MatchPlanes&, const unsigned short*, unsigned, unsigned, unsigned, unsigned);
+  unsigned match_kernel_avx2(const MatchPlanes&, const unsigned short*, unsigned, unsigned, unsigned, unsigned);
+  unsigned match_kernel_avx512(const MatchPlanes&, const unsigned short*, unsigned, unsigned, unsigned, unsigned);
+  void block_kernel_sse42(const byte*, const unsigned short*, unsigned, unsigned, unsigned*);
+  void block_kernel_avx2(const byte*, const unsigned short*, unsigned, unsigned, unsigned*);
+  void block_kernel_avx512(const byte*, const unsigned short*, unsigned, unsigned, unsigned*);
+#endif
+
+  // The helpers below are compiled into translation units built for
+  // different instruction sets, so they have internal linkage to keep the
+  // linker from sharing one instruction set's copy with the others.
+
+  // Total penalty of a nearest cell shared by count points.  Equivalent to
+  // counting them one at a time in a byte, adding sqr(c) - sqr(c-1) on each
+  // step above dest_thres (sqr(c) on the first such step); the byte wraps
+  // every 256 points, keeping the 255*255 reached before wrapping.
+  static inline unsigned cell_penalty(unsigned count, unsigned dest_thres)
+  {
+    if (dest_thres >= 255) return 0;
+    unsigned c = count & 255;
+    unsigned penalty = (count >> 8) * (255U * 255U);
+    if (c > dest_thres) penalty += c * c;
+    return penalty;
+  }
+
+  // Scalar loop over points [begin,end), shared by all kernels for the tail.
+  // Adds distances above thres to sum and appends the nearest cell of each
+  // such point to cells.
+  static inline unsigned collect_points(const MatchPlanes& m, const unsigned short* offsets,
+                                 unsigned begin, unsigned end, unsigned thres, unsigned bound,
+                                 unsigned sum, unsigned* cells, unsigned& n)
+  {
+    for (unsigned i = begin; i < end; ++i)
+    {
+      unsigned offset = offsets[i];
+      unsigned d = m.dist[offset];
+      if (d > thres)
+      {
+        sum += d;
+        cells[n++] = m.near_y[offset] * m.grid + m.near_x[offset];
+        if (sum > bound) return sum;
+      }
+    }
+    return sum;
+  }
+
+  static inline unsigned collect_points_compact(const MatchPlanes& m, const unsigned short* offsets,
+                                 unsigned begin, unsigned end, unsigned thres, unsigned bound,
+                                 unsigned sum, unsigned* cells, unsigned& n)
+  {
+    for (unsigned i = begin; i < end; ++i)
+    {
+      unsigned offset = offsets[i];
+      unsigned d = m.dist8[offset];
+      if (d > thres)
+      {
+        sum += d;
+        cells[n++] = m.near_index[offset];
+        if (sum > bound) return sum;
+      }
+    }
+    return sum;
+  }
+
+  // Squared distance for a point offset (g*plane_size + pos) in PLANES_LEAN
+  // planes, setting at to the offset of the plane cell it came from.
+  static inline unsigned lean_lookup(const MatchPlanes& m, unsigned plane_size, unsigned magic,
+                                     unsigned offset, unsigned& at)
+  {
+    unsigned g = (offset * magic) >> 24;
+    unsigned pos = offset - g * plane_size;
+    unsigned slot = m.plane_slot[g];
+    if (slot != LEAN_COMBINE)
+    {
+      at = slot * plane_size + pos;
+      return m.dist[at];
+    }
+    unsigned d = UINT_MAX;
+    for (unsigned b = 0; b < 4; ++b)
+    {
+      if ((g & (1U << b)) == 0) continue;
+      unsigned o = b * plane_size + pos;
+      if (m.dist[o] < d)
+      {
+        d = m.dist[o];
+        at = o;
+      }
+    }
+    return d;
+  }
+
+  static inline unsigned collect_points_lean(const MatchPlanes& m, const unsigned short* offsets,
+                                 unsigned begin, unsigned end, unsigned thres, unsigned bound,
+                                 unsigned sum, unsigned* cells, unsigned& n)
+  {
+    const unsigned plane_size = m.grid * m.grid, magic = plane_magic(plane_size);
+    for (unsigned i = begin; i < end; ++i)
+    {
+      unsigned at = 0;
+      unsigned d = lean_lookup(m, plane_size, magic, offsets[i], at);
+      if (d > thres)
+      {
+        sum += d;
+        cells[n++] = m.near_y[at] * m.grid + m.near_x[at];
+        if (sum > bound) return sum;
+      }
+    }
+    return sum;
+  }
+
+  static inline unsigned add_cell_penalties(unsigned sum, const unsigned* cells, unsigned n,
+                                            unsigned dest_thres)
+  {
+    if (n <= dest_thres) return sum;
+    // Every counter touched below is cleared again by the second loop,
+    // so the per thread table stays zeroed between calls.
+    static thread_local unsigned short counts[MAX_GRID*MAX_GRID];
+    for (unsigned i = 0; i < n; ++i)
+      ++counts[cells[i]];
+    for (unsigned i = 0; i < n; ++i)
+    {
+      unsigned short& c = counts[cells[i]];
+      if (c > dest_thres) sum += cell_penalty(c, dest_thres);
+      c = 0;
+    }
+    return sum;
+  }
+
+  static inline unsigned lowest_bit(unsigned mask)
+  {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return unsigned(index);
+#else
+    return unsigned(__builtin_ctz(mask));
+#endif
+  }
+
+  static inline unsigned bit_count(unsigned mask)
+  {
+#ifdef _MSC_VER
+    return unsigned(__popcnt(mask));
+#else
+    return unsigned(__builtin_popcount(mask));
+#endif
+  }
+
+} // namespace OpticMatch
+
+#endif // H_KERNELS_OPTMATCH
@@ -0,0 +1,121 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+#include "stdafx.h"
+#include "mapped_file.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace OpticMatch {
+
+#ifdef WIN32
+
+  MappedFile::MappedFile(const std::string& path)
+    : m_Data(nullptr)
+    , m_Size(0)
+    , m_File(INVALID_HANDLE_VALUE)
+    , m_Mapping(nullptr)
+  {
+    m_File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_File == INVALID_HANDLE_VALUE) throw general_message_exception("Failed to open model file: " + path);
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_File, &size) || size.QuadPart == 0)
+    {
+      CloseHandle(m_File);
+      throw general_message_exception("Failed to read model file: " + path);
+    }
+    m_Size = size_t(size.QuadPart);
+    m_Mapping = CreateFileMapping(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_Mapping) m_Data = static_cast<const unsigned char*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_Data)
+    {
+      if (m_Mapping) CloseHandle(m_Mapping);
+      CloseHandle(m_File);
+      throw general_message_exception("Failed to map model file: " + path);
+    }
+  }
+
+  MappedFile::~MappedFile()
+  {
+    UnmapViewOfFile(m_Data);
+    CloseHandle(m_Mapping);
+    CloseHandle(m_File);
+  }
+
+  // Windows refuses to replace a file that is mapped, this then fails
+  void replace_file(const std::string& from, const std::string& to)
+  {
+    if (!MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+      DeleteFileA(from.c_str());
+      throw general_message_exception("Failed to replace model file: " + to);
+    }
+  }
+
+#else
+
+  MappedFile::MappedFile(const std::string& path)
+    : m_Data(nullptr)
+    , m_Size(0)
+  {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw general_message_exception("Failed to open model file: " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+      close(fd);
+      throw general_message_exception("Failed to read model file: " + path);
+    }
+    m_Size = size_t(st.st_size);
+    void* p = mmap(nullptr, m_Size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) throw general_message_exception("Failed to map model file: " + path);
+    m_Data = static_cast<const unsigned char*>(p);
+  }
+
+  MappedFile::~MappedFile()
+  {
+    munmap(const_cast<unsigned char*>(m_Data), m_Size);
+  }
+
+  void replace_file(const std::string& from, const std::string& to)
+  {
+    if (rename(from.c_str(), to.c_str()) != 0)
+    {
+      unlink(from.c_str());
+      throw general_message_exception("Failed to replace model file: " + to);
+    }
+  }
+
+#endif
+
+} // namespace OpticMatch
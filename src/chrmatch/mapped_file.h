@@ -0,0 +1,62 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+#ifndef H_MAPPED_FILE_OPTMATCH
+#define H_MAPPED_FILE_OPTMATCH
+
+#include <string>
+
+namespace OpticMatch {
+
+  // Read only memory mapping of a whole file.  The mapping is shared with
+  // every other process mapping the same file, so they all use a single
+  // page cache copy.
+  class MappedFile
+  {
+    const unsigned char* m_Data;
+    size_t               m_Size;
+#ifdef WIN32
+    void*                m_File;
+    void*                m_Mapping;
+#endif
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator= (const MappedFile&);
+  public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    const unsigned char* data() const { return m_Data; }
+    size_t size() const { return m_Size; }
+  };
+
+  // Moves the file at from over the one at to in a single step, so a
+  // process mapping the old file keeps reading it unchanged.  On failure
+  // from is removed and to is left as it was.
+  void replace_file(const std::string& from, const std::string& to);
+
+} // namespace OpticMatch
+
+#endif // H_MAPPED_FILE_OPTMATCH
@@ -92,4 +92,52 @@ public:
 };
 
 
+// Matrix with compile time dimensions, stored inline so it can live on
+// the stack.  Same element access interface as Matrix.
+template<class T, int W, int H>
+class FixedMatrix
+{
+  T m_Elements[W*H];
+public:
+  FixedMatrix() {}
+
+  explicit FixedMatrix(const T& init_value)
+  {
+    fill(init_value);
+  }
+
+  void fill(const T& value)
+  {
+    for (int i = 0; i < W*H; ++i)
+      m_Elements[i] = value;
+  }
+
+  const T& operator() (int x, int y) const
+  {
+    assert(x >= 0 && y >= 0 && x < W && y < H);
+    return m_Elements[y*W + x];
+  }
+
+  T& operator() (int x, int y)
+  {
+    assert(x >= 0 && y >= 0 && x < W && y < H);
+    return m_Elements[y*W + x];
+  }
+
+  const T* get_row(int y) const
+  {
+    assert(y >= 0 && y < H);
+    return &m_Elements[y*W];
+  }
+
+  T* get_row(int y)
+  {
+    assert(y >= 0 && y < H);
+    return &m_Elements[y*W];
+  }
+
+  unsigned get_width()  const { return W; }
+  unsigned get_height() const { return H; }
+};
+
 #endif // H_MATRIX
@@ -0,0 +1,87 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+#ifndef H_MODEL_FILE_OPTMATCH
+#define H_MODEL_FILE_OPTMATCH
+
+#include <cstdint>
+
+namespace OpticMatch {
+
+  // Binary trained model file.  All integers are in the writer's byte order,
+  // checked through the endian field.  Every section and every template block
+  // starts on a 64 byte boundary, so a memory mapped file can be used in
+  // place:
+  //
+  //   ModelHeader
+  //   ModelClass    x class_count     (at classes_offset)
+  //   ModelTemplate x template_count  (at templates_offset)
+  //   uint32_t x grid x template_count (at bitmaps_offset)
+  //   template blocks, in the Perimeter block layout
+  //
+  // Templates of a class are contiguous in the template table.  The bitmaps
+  // are the packed normalized glyphs of the templates, grid rows each, used
+  // to find duplicates of new training samples.
+  const char     MODEL_MAGIC[8] = { 'O', 'P', 'T', 'M', 'A', 'T', 'C', 'H' };
+  const uint32_t MODEL_VERSION  = 1;
+  const uint32_t MODEL_ENDIAN   = 0x01020304;
+
+  struct ModelHeader
+  {
+    char     magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint32_t grid;
+    uint32_t class_count;
+    uint32_t template_count;
+    uint32_t reserved;
+    uint64_t classes_offset;
+    uint64_t templates_offset;
+    uint64_t bitmaps_offset;
+    uint64_t file_size;
+  };
+
+  struct ModelClass
+  {
+    uint32_t ch;
+    uint32_t first_template;
+    uint32_t template_count;
+    uint32_t reserved;
+  };
+
+  struct ModelTemplate
+  {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t point_count;
+    float    aspect;        // Glyph width / height before normalization
+    uint32_t multiplicity;  // Training samples sharing this template
+    uint32_t format;        // PlaneFormat of the block
+    uint32_t reserved;
+  };
+
+} // namespace OpticMatch
+
+#endif // H_MODEL_FILE_OPTMATCH
@@ -0,0 +1,206 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+#ifndef H_PARALLEL_OPTMATCH
+#define H_PARALLEL_OPTMATCH
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <exception>
+
+namespace OpticMatch {
+
+  inline unsigned resolve_thread_count(unsigned threads, size_t work_items)
+  {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    if (size_t(threads) > work_items) threads = unsigned(work_items);
+    return threads;
+  }
+
+  // Calls func(worker, begin, end) over [0,count) in chunks pulled from a
+  // shared counter.  worker is in [0,threads) so callers can keep per worker
+  // scratch state.  The first exception thrown by any worker is rethrown
+  // after all workers have joined.
+  template<class FUNC>
+  void parallel_for(size_t count, unsigned threads, size_t chunk, FUNC func)
+  {
+    if (count == 0) return;
+    if (chunk == 0) chunk = 1;
+    threads = resolve_thread_count(threads, (count + chunk - 1) / chunk);
+    if (threads <= 1)
+    {
+      func(0U, size_t(0), count);
+      return;
+    }
+    std::atomic<size_t> next(0);
+    std::vector<std::exception_ptr> errors(threads);
+    auto worker = [&](unsigned id)
+    {
+      try
+      {
+        while (true)
+        {
+          size_t begin = next.fetch_add(chunk);
+          if (begin >= count) break;
+          size_t end = begin + chunk;
+          if (end > count) end = count;
+          func(id, begin, end);
+        }
+      }
+      catch (...)
+      {
+        errors[id] = std::current_exception();
+        next.store(count);
+      }
+    };
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (unsigned i = 1; i < threads; ++i)
+      pool.push_back(std::thread(worker, i));
+    worker(0);
+    for (auto& t : pool) t.join();
+    for (auto& e : errors)
+      if (e) std::rethrow_exception(e);
+  }
+
+  // Workers started once and reused by many loops.  start() hands
+  // func(worker, begin, end) over [0,count) in chunks to the workers and
+  // returns at once, so the caller can work meanwhile; wait() blocks until
+  // the loop is done and rethrows the first exception thrown by a worker.
+  // Call wait() before the next start().  The destructor waits for a
+  // running loop and joins the workers.
+  class WorkerPool
+  {
+  public:
+    explicit WorkerPool(unsigned threads)
+      : m_Count(0)
+      , m_Chunk(1)
+      , m_Next(0)
+      , m_Round(0)
+      , m_Busy(0)
+      , m_Stop(false)
+    {
+      if (threads == 0) threads = 1;
+      m_Threads.reserve(threads);
+      for (unsigned i = 0; i < threads; ++i)
+        m_Threads.push_back(std::thread(&WorkerPool::work, this, i));
+    }
+
+    ~WorkerPool()
+    {
+      {
+        std::unique_lock<std::mutex> lock(m_Lock);
+        m_Done.wait(lock, [this] { return m_Busy == 0; });
+        m_Stop = true;
+      }
+      m_Wake.notify_all();
+      for (auto& t : m_Threads) t.join();
+    }
+
+    unsigned size() const { return unsigned(m_Threads.size()); }
+
+    template<class FUNC>
+    void start(size_t count, size_t chunk, FUNC func)
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Func = func;
+        m_Count = count;
+        m_Chunk = (chunk == 0 ? 1 : chunk);
+        m_Next.store(0);
+        m_Busy = size();
+        ++m_Round;
+      }
+      m_Wake.notify_all();
+    }
+
+    void wait()
+    {
+      std::exception_ptr error;
+      {
+        std::unique_lock<std::mutex> lock(m_Lock);
+        m_Done.wait(lock, [this] { return m_Busy == 0; });
+        std::swap(error, m_Error);
+      }
+      if (error) std::rethrow_exception(error);
+    }
+
+  private:
+    std::vector<std::thread>  m_Threads;
+    std::mutex                m_Lock;
+    std::condition_variable   m_Wake;
+    std::condition_variable   m_Done;
+    std::function<void(unsigned, size_t, size_t)> m_Func;
+    size_t                    m_Count;
+    size_t                    m_Chunk;
+    std::atomic<size_t>       m_Next;
+    uint64_t                  m_Round;
+    unsigned                  m_Busy;
+    bool                      m_Stop;
+    std::exception_ptr        m_Error;
+
+    void work(unsigned id)
+    {
+      uint64_t seen = 0;
+      while (true)
+      {
+        {
+          std::unique_lock<std::mutex> lock(m_Lock);
+          m_Wake.wait(lock, [this, seen] { return m_Stop || m_Round != seen; });
+          if (m_Stop) return;
+          seen = m_Round;
+        }
+        try
+        {
+          while (true)
+          {
+            size_t begin = m_Next.fetch_add(m_Chunk);
+            if (begin >= m_Count) break;
+            size_t end = begin + m_Chunk;
+            if (end > m_Count) end = m_Count;
+            m_Func(id, begin, end);
+          }
+        }
+        catch (...)
+        {
+          std::lock_guard<std::mutex> lock(m_Lock);
+          if (!m_Error) m_Error = std::current_exception();
+          m_Next.store(m_Count);
+        }
+        std::lock_guard<std::mutex> lock(m_Lock);
+        if (--m_Busy == 0) m_Done.notify_all();
+      }
+    }
+  };
+
+} // namespace OpticMatch
+
+#endif // H_PARALLEL_OPTMATCH
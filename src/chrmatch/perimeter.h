@@ -0,0 +1,778 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+#ifndef H_PERIMETER_OPTMATCH
+#define H_PERIMETER_OPTMATCH
+
+#include <list>
+#include <memory>
+#include <string>
+#include <exception>
+#include <atomic>
+#include <cmath>
+#include <climits>
+#include <opencv2/opencv.hpp>
+#include "matrix.h"
+#include "utils.h"
+#include "aligned.h"
+#include "kernels.h"
+#include "descriptor.h"
+#include "bitmap.h"
+#include <optmatch/exceptions.h>
+
+namespace OpticMatch {
+
+  typedef unsigned char byte;
+
+  class PerimeterPixel
+  {
+    byte   px,py;
+    byte   gradients;
+  public:
+    PerimeterPixel(byte x = 0, byte y = 0)
+      : px(x), py(y), gradients(0)
+    {}
+
+    byte x() const { return px; }
+    byte y() const { return py; }
+    byte g() const { return gradients; }
+
+    void set_grad(byte g)    { gradients = g; }
+    void add_grad(byte g)    { gradients |= g; }
+    void set(byte x, byte y) { px = x; py = y; }
+  };
+
+  class Cell
+  {
+    byte           m_X,m_Y;
+    unsigned short m_SqDist;
+  public:
+    Cell(unsigned x = 0, unsigned y = 0, unsigned short sqdist = 65535)
+      : m_X(x)
+      , m_Y(y)
+      , m_SqDist(sqdist)
+    {}
+
+    byte x() const { return m_X; }
+    byte y() const { return m_Y; }
+
+    unsigned short sqr_dist() const { return m_SqDist; }
+    void set(unsigned short sd) { m_SqDist = sd; }
+    void set(byte x, byte y) { m_X = x; m_Y = y; }
+    void set(byte x, byte y, unsigned short sd) { set(x, y); m_SqDist = sd; }
+  };
+
+  inline std::ostream& operator << (std::ostream& os, const Cell& c)
+  {
+    return os << c.sqr_dist();
+  }
+
+  typedef std::list<PerimeterPixel> pp_seq;
+  typedef std::vector<byte> bvec;
+
+  const int LEFT_IDX = 0;
+  const int TOP_IDX = 1;
+  const int RIGHT_IDX = 2;
+  const int BOTTOM_IDX = 3;
+
+  const unsigned LEFT = 1;
+  const unsigned TOP = 2;
+  const unsigned RIGHT = 4;
+  const unsigned BOTTOM = 8;
+
+  // Default match thresholds: squared distances up to THRES are free and
+  // a nearest cell may be shared by DEST_THRES points before it costs
+  const unsigned THRES = 4;
+  const unsigned DEST_THRES = 4;
+
+  // Algorithm used to spread boundary distances over the matrices.
+  // DT_BFS is the original queue based propagation, DT_CHECK runs both and
+  // records the differences in the EdtCheckStats counters.
+  enum DistanceTransform { DT_EXACT, DT_BFS, DT_CHECK };
+
+  struct EdtCheckStats
+  {
+    std::atomic<unsigned long> matrices;    // matrices built by both algorithms
+    std::atomic<unsigned long> cells;       // cells compared
+    std::atomic<unsigned long> differing;   // cells where the distances differ
+    std::atomic<unsigned long> exact_worse; // cells where exact > BFS, always 0 unless broken
+  };
+
+  EdtCheckStats& edt_check_stats();
+
+  // Breadth first propagation of the nearest boundary pixel from the cells
+  // with distance 0.  Approximate: cells may keep a source that is not the
+  // nearest one.
+  template<class MAT>
+  void bfs_transform(MAT& m)
+  {
+    int x, y, w = m.get_width(), h = m.get_height();
+    pp_seq horizon;
+    for (y = 0; y < h; ++y)
+    {
+      Cell* row = m.get_row(y);
+      for (x = 0; x < w; ++x)
+      {
+        if (row[x].sqr_dist() == 0)
+        {
+          row[x].set(x, y);
+          horizon.push_back(PerimeterPixel(x, y));
+        }
+      }
+    }
+
+    while (!horizon.empty())
+    {
+      PerimeterPixel p = horizon.front();
+      horizon.pop_front();
+      x = p.x();
+      y = p.y();
+      const Cell o = m(x, y);
+      int nx[4] = { x - 1, x + 1, x, x };
+      int ny[4] = { y, y, y - 1, y + 1 };
+      for (int i = 0; i < 4; ++i)
+      {
+        if (nx[i] < 0 || nx[i] >= w || ny[i] < 0 || ny[i] >= h) continue;
+        unsigned short sd = sqr(nx[i] - int(o.x())) + sqr(ny[i] - int(o.y()));
+        if (sd < m(nx[i], ny[i]).sqr_dist())
+        {
+          m(nx[i], ny[i]).set(o.x(), o.y(), sd);
+          horizon.push_back(PerimeterPixel(nx[i], ny[i]));
+        }
+      }
+    }
+  }
+
+  // Exact squared Euclidean distance transform, tracking the nearest
+  // boundary pixel.  Separable: a column pass finds the nearest source in
+  // each column, then a row pass takes the lower envelope of the parabolas
+  // (x-q)^2 + column_dist(x)^2 (Felzenszwalb & Huttenlocher), so each
+  // pass is linear in the number of cells.
+  template<class MAT>
+  void exact_transform(MAT& m)
+  {
+    const int INF = -1;
+    int w = m.get_width(), h = m.get_height();
+    int  col_d[MAX_GRID*MAX_GRID];
+    byte col_y[MAX_GRID*MAX_GRID];
+    for (int x = 0; x < w; ++x)
+    {
+      int last = INF;
+      for (int y = 0; y < h; ++y)
+      {
+        if (m(x, y).sqr_dist() == 0) last = y;
+        col_d[y*w + x] = (last == INF ? INF : y - last);
+        col_y[y*w + x] = byte(last);
+      }
+      last = INF;
+      for (int y = h - 1; y >= 0; --y)
+      {
+        if (m(x, y).sqr_dist() == 0) last = y;
+        int& d = col_d[y*w + x];
+        if (last != INF && (d == INF || (last - y) < d))
+        {
+          d = last - y;
+          col_y[y*w + x] = byte(last);
+        }
+      }
+    }
+    int    v[MAX_GRID], f[MAX_GRID];
+    double z[MAX_GRID + 1];
+    for (int y = 0; y < h; ++y)
+    {
+      const int* dr = &col_d[y*w];
+      int k = -1;
+      for (int x = 0; x < w; ++x)
+      {
+        if (dr[x] == INF) continue;
+        f[x] = dr[x] * dr[x];
+        double s = 0;
+        while (k >= 0)
+        {
+          int p = v[k];
+          s = double((f[x] + x*x) - (f[p] + p*p)) / (2 * (x - p));
+          if (s > z[k]) break;
+          --k;
+        }
+        ++k;
+        v[k] = x;
+        z[k] = (k == 0 ? -1e30 : s);
+        z[k + 1] = 1e30;
+      }
+      if (k < 0) return; // No sources at all
+      Cell* row = m.get_row(y);
+      for (int q = 0, j = 0; q < w; ++q)
+      {
+        while (z[j + 1] < q) ++j;
+        int x = v[j];
+        row[q].set(byte(x), col_y[y*w + x], (unsigned short)(sqr(q - x) + f[x]));
+      }
+    }
+  }
+
+  template<class MAT>
+  void distance_transform(MAT& m, DistanceTransform method)
+  {
+    if (method == DT_BFS)
+      bfs_transform(m);
+    else
+    if (method == DT_EXACT)
+      exact_transform(m);
+    else
+    {
+      MAT ref(m);
+      bfs_transform(ref);
+      exact_transform(m);
+      unsigned long differing = 0, worse = 0, cells = 0;
+      for (unsigned y = 0; y < m.get_height(); ++y)
+        for (unsigned x = 0; x < m.get_width(); ++x, ++cells)
+        {
+          unsigned short e = m(x, y).sqr_dist(), b = ref(x, y).sqr_dist();
+          if (e != b) ++differing;
+          if (e > b) ++worse;
+        }
+      EdtCheckStats& stats = edt_check_stats();
+      ++stats.matrices;
+      stats.cells += cells;
+      stats.differing += differing;
+      stats.exact_worse += worse;
+    }
+  }
+
+  // The 16 directional distance matrices and the perimeter points of an
+  // N x N glyph are kept in a single aligned block, laid out as structure
+  // of arrays:
+  //
+  //   [ squared distance planes : 16 x N^2 unsigned short      ]
+  //   [ nearest point x planes  : 16 x N^2 byte                ]
+  //   [ nearest point y planes  : 16 x N^2 byte                ]
+  //   [ point plane offsets     : point count x unsigned short ]
+  //   [ perimeter points        : point count x PerimeterPixel ]
+  //
+  // Plane g holds the distance to the nearest boundary pixel having any of
+  // the gradient bits in g, so the match loop only touches the distance
+  // planes unless a point is further than the threshold.  The offset of a
+  // point is g*N^2 + y*N + x, letting the match kernels look it up in the
+  // other perimeter's planes with a single gather.
+  //
+  // The block is either owned or, for models loaded from a file, a view
+  // into a memory mapping kept alive by m_Mapping.
+  //
+  // Templates may be converted to PLANES_COMPACT, which replaces the three
+  // plane groups with
+  //
+  //   [ saturated squared distance planes : 16 x N^2 byte ]
+  //   [ nearest point index planes        : 16 x N^2 byte ]
+  //
+  // halving the block, or to PLANES_LEAN, which keeps the three plane groups
+  // for the four single direction planes and the combinations most used by
+  // the template's own points only, behind a 64 byte header:
+  //
+  //   [ plane slot of each gradient combination : 16 byte, then the stored plane count ]
+  //
+  // The accessors of the plane groups above are only valid for PLANES_FULL.
+  template<int N>
+  class Perimeter
+  {
+  public:
+    enum { SIZE = N, PLANES = 16, PLANE_SIZE = N*N };
+    typedef FixedMatrix<Cell, N, N> cell_mat;
+  private:
+    static_assert(N <= int(MAX_GRID), "Grid size not supported by the match kernels");
+    static const size_t DIST_BYTES = PLANES * PLANE_SIZE * sizeof(unsigned short);
+    static const size_t NEAR_BYTES = PLANES * PLANE_SIZE;
+    static const size_t LEAN_HEADER = CACHE_LINE;
+
+    AlignedBuffer               m_Block;
+    const byte*                 m_Data;
+    size_t                      m_Size;
+    std::shared_ptr<const void> m_Mapping;
+    unsigned                    m_PointCount;
+    PlaneFormat                 m_Format;
+    unsigned                    m_Planes;  // Stored planes
+    GlyphDescriptor             m_Descriptor;
+
+    static size_t planes_bytes(PlaneFormat format, unsigned planes)
+    {
+      if (format == PLANES_COMPACT) return 2 * NEAR_BYTES;
+      if (format == PLANES_LEAN) return LEAN_HEADER + planes * PLANE_SIZE * (sizeof(unsigned short) + 2);
+      return DIST_BYTES + 2 * NEAR_BYTES;
+    }
+
+    MatchPlanes lean_planes() const
+    {
+      const byte* planes = m_Data + LEAN_HEADER;
+      const byte* near_x = planes + m_Planes * PLANE_SIZE * sizeof(unsigned short);
+      MatchPlanes m = { reinterpret_cast<const unsigned short*>(planes), near_x, near_x + m_Planes * PLANE_SIZE,
+                        N, PLANES_LEAN, nullptr, nullptr, m_Data };
+      return m;
+    }
+
+    unsigned short* dist_data()   { return reinterpret_cast<unsigned short*>(m_Block.data()); }
+    byte*           near_x_data() { return m_Block.data() + DIST_BYTES; }
+    byte*           near_y_data() { return near_x_data() + NEAR_BYTES; }
+    unsigned short* offsets_data() { return reinterpret_cast<unsigned short*>(near_y_data() + NEAR_BYTES); }
+    PerimeterPixel* points_data() { return reinterpret_cast<PerimeterPixel*>(offsets_data() + m_PointCount); }
+
+    void store_plane(unsigned g, const cell_mat& m)
+    {
+      unsigned short* dist = dist_data() + g*PLANE_SIZE;
+      byte* nx = near_x_data() + g*PLANE_SIZE;
+      byte* ny = near_y_data() + g*PLANE_SIZE;
+      for (int y = 0; y < N; ++y)
+      {
+        const Cell* row = m.get_row(y);
+        for (int x = 0; x < N; ++x, ++dist, ++nx, ++ny)
+        {
+          *dist = row[x].sqr_dist();
+          *nx = row[x].x();
+          *ny = row[x].y();
+        }
+      }
+    }
+
+    void clear_plane(unsigned g)
+    {
+      std::fill(dist_data() + g*PLANE_SIZE, dist_data() + (g + 1)*PLANE_SIZE, (unsigned short)65535);
+      memset(near_x_data() + g*PLANE_SIZE, 0, PLANE_SIZE);
+      memset(near_y_data() + g*PLANE_SIZE, 0, PLANE_SIZE);
+    }
+
+    void minimize_plane(unsigned dst, unsigned src)
+    {
+      unsigned short* ddist = dist_data() + dst*PLANE_SIZE;
+      byte* dnx = near_x_data() + dst*PLANE_SIZE;
+      byte* dny = near_y_data() + dst*PLANE_SIZE;
+      const unsigned short* sdist = dist_data() + src*PLANE_SIZE;
+      const byte* snx = near_x_data() + src*PLANE_SIZE;
+      const byte* sny = near_y_data() + src*PLANE_SIZE;
+      for (unsigned i = 0; i < PLANE_SIZE; ++i)
+      {
+        if (sdist[i] < ddist[i])
+        {
+          ddist[i] = sdist[i];
+          dnx[i] = snx[i];
+          dny[i] = sny[i];
+        }
+      }
+    }
+
+    // The single direction planes (1,2,4,8) are the base matrices,
+    // every other plane is the cell-wise minimum of its base planes.
+    void finalize_matrices(cell_mat* base, DistanceTransform method)
+    {
+      static const unsigned base_plane[4] = { LEFT, TOP, RIGHT, BOTTOM };
+      for (unsigned i = 0; i < 4; ++i)
+      {
+        distance_transform(base[i], method);
+        store_plane(base_plane[i], base[i]);
+      }
+      for (unsigned i = 0; i < PLANES; ++i)
+      {
+        if (i == LEFT || i == TOP || i == RIGHT || i == BOTTOM) continue;
+        clear_plane(i);
+        for (unsigned j = 0; j < 4; ++j)
+          if ((i & base_plane[j]) == base_plane[j]) minimize_plane(i, base_plane[j]);
+      }
+    }
+  public:
+    Perimeter() : m_Data(nullptr), m_Size(0), m_PointCount(0), m_Format(PLANES_FULL), m_Planes(PLANES) {}
+
+    Perimeter(const cv::Mat& image, DistanceTransform method = DT_EXACT)
+      : m_Data(nullptr)
+      , m_Size(0)
+      , m_PointCount(0)
+      , m_Format(PLANES_FULL)
+      , m_Planes(PLANES)
+    {
+      build_matrices(image, method);
+    }
+
+    Perimeter(const uint32_t* rows, DistanceTransform method = DT_EXACT)
+      : m_Data(nullptr)
+      , m_Size(0)
+      , m_PointCount(0)
+      , m_Format(PLANES_FULL)
+      , m_Planes(PLANES)
+    {
+      build_matrices(rows, method);
+    }
+
+    Perimeter(const Perimeter& o)
+      : m_Block(o.m_Block)
+      , m_Data(o.m_Block.empty() ? o.m_Data : m_Block.data())
+      , m_Size(o.m_Size)
+      , m_Mapping(o.m_Mapping)
+      , m_PointCount(o.m_PointCount)
+      , m_Format(o.m_Format)
+      , m_Planes(o.m_Planes)
+      , m_Descriptor(o.m_Descriptor)
+    {}
+
+    Perimeter(Perimeter&& o)
+      : m_Block(std::move(o.m_Block))
+      , m_Data(o.m_Data)
+      , m_Size(o.m_Size)
+      , m_Mapping(std::move(o.m_Mapping))
+      , m_PointCount(o.m_PointCount)
+      , m_Format(o.m_Format)
+      , m_Planes(o.m_Planes)
+      , m_Descriptor(o.m_Descriptor)
+    {
+      o.m_Data = nullptr;
+      o.m_Size = 0;
+      o.m_PointCount = 0;
+    }
+
+    Perimeter& operator= (Perimeter o)
+    {
+      m_Block.swap(o.m_Block);
+      std::swap(m_Data, o.m_Data);
+      std::swap(m_Size, o.m_Size);
+      m_Mapping.swap(o.m_Mapping);
+      std::swap(m_PointCount, o.m_PointCount);
+      std::swap(m_Format, o.m_Format);
+      std::swap(m_Planes, o.m_Planes);
+      std::swap(m_Descriptor, o.m_Descriptor);
+      return *this;
+    }
+
+    // Wraps a block in the layout above that lives in memory kept alive by
+    // mapping.  Throws if the block is too small or if a point offset, a
+    // point or a nearest point lies outside the grid, so that matching and
+    // converting the perimeter stay within its block whatever it holds.
+    static Perimeter from_block(const byte* data, size_t size, unsigned point_count,
+                                std::shared_ptr<const void> mapping, float aspect = 0,
+                                PlaneFormat format = PLANES_FULL)
+    {
+      unsigned planes = PLANES;
+      if (format == PLANES_LEAN)
+      {
+        if (size < LEAN_HEADER) throw general_message_exception("Perimeter block is truncated");
+        planes = data[PLANES];
+        if (planes < 4 || planes > PLANES) throw general_message_exception("Perimeter block is corrupt");
+        for (unsigned g = 0; g < PLANES; ++g)
+          if (data[g] != LEAN_COMBINE && data[g] >= planes) throw general_message_exception("Perimeter block is corrupt");
+        if (data[LEFT] != 0 || data[TOP] != 1 || data[RIGHT] != 2 || data[BOTTOM] != 3)
+          throw general_message_exception("Perimeter block is corrupt");
+      }
+      if (size < block_size(point_count, format, planes)) throw general_message_exception("Perimeter block is truncated");
+      Perimeter p;
+      p.m_Data = data;
+      p.m_Size = size;
+      p.m_Mapping = mapping;
+      p.m_PointCount = point_count;
+      p.m_Format = format;
+      p.m_Planes = planes;
+      const unsigned short* offsets = p.offsets();
+      for (unsigned i = 0; i < point_count; ++i)
+        if (offsets[i] >= PLANES * PLANE_SIZE) throw general_message_exception("Perimeter block is corrupt");
+      for (const_iterator it = p.begin(); it != p.end(); ++it)
+        if (it->x() >= N || it->y() >= N || it->g() >= PLANES) throw general_message_exception("Perimeter block is corrupt");
+      if (format != PLANES_COMPACT)
+      {
+        const byte* near = (format == PLANES_LEAN ? p.lean_planes().near_x : p.near_x_plane(0));
+        for (size_t i = 0; i < 2 * planes * PLANE_SIZE; ++i)
+          if (near[i] >= N) throw general_message_exception("Perimeter block is corrupt");
+      }
+      p.m_Descriptor.compute(p.begin(), p.end(), N);
+      p.m_Descriptor.aspect = aspect;
+      return p;
+    }
+
+    static size_t block_size(unsigned point_count, PlaneFormat format = PLANES_FULL, unsigned planes = PLANES)
+    {
+      return planes_bytes(format, planes) + point_count * (sizeof(unsigned short) + sizeof(PerimeterPixel)) + GATHER_SLACK;
+    }
+
+    // Makes the owned block large enough for point_count points, so that
+    // rebuilding a reused perimeter does not allocate
+    void reserve(unsigned point_count)
+    {
+      if (m_Block.size() < block_size(point_count))
+        AlignedBuffer(block_size(point_count)).swap(m_Block);
+    }
+
+    const byte* block() const { return m_Data; }
+    size_t block_size() const { return m_Size; }
+    PlaneFormat format() const { return m_Format; }
+
+    // Squared distance at a plane offset (g*N^2 + y*N + x), in any format
+    unsigned distance_at(unsigned offset) const
+    {
+      if (m_Format == PLANES_COMPACT) return m_Data[offset];
+      if (m_Format == PLANES_LEAN)
+      {
+        unsigned at;
+        return lean_lookup(lean_planes(), PLANE_SIZE, plane_magic(PLANE_SIZE), offset, at);
+      }
+      return dist_plane(0)[offset];
+    }
+
+    // Converts the planes to PLANES_COMPACT in a new owned block.  Returns
+    // false and keeps the full planes if there are more than 256 points.
+    bool compact()
+    {
+      if (m_Format == PLANES_COMPACT) return true;
+      if (m_Format != PLANES_FULL || m_PointCount > 256 || !m_Data) return false;
+      byte point_at[PLANE_SIZE] = { 0 };
+      const PerimeterPixel* points = begin();
+      for (unsigned i = 0; i < m_PointCount; ++i)
+        point_at[points[i].y()*N + points[i].x()] = byte(i);
+      AlignedBuffer block(block_size(m_PointCount, PLANES_COMPACT));
+      byte* dist8 = block.data();
+      byte* near_index = dist8 + NEAR_BYTES;
+      const unsigned short* dist = dist_plane(0);
+      const byte* nx = near_x_plane(0);
+      const byte* ny = near_y_plane(0);
+      for (unsigned i = 0; i < PLANES * PLANE_SIZE; ++i)
+      {
+        dist8[i] = byte(std::min<unsigned>(dist[i], 255));
+        near_index[i] = point_at[ny[i] * N + nx[i]];
+      }
+      memcpy(block.data() + planes_bytes(PLANES_COMPACT, PLANES), offsets(),
+             m_PointCount * (sizeof(unsigned short) + sizeof(PerimeterPixel)));
+      memset(block.data() + block_size(m_PointCount, PLANES_COMPACT) - GATHER_SLACK, 0, GATHER_SLACK);
+      m_Block.swap(block);
+      m_Data = m_Block.data();
+      m_Size = block_size(m_PointCount, PLANES_COMPACT);
+      m_Mapping.reset();
+      m_Format = PLANES_COMPACT;
+      return true;
+    }
+
+    // Converts the planes to PLANES_LEAN in a new owned block, keeping the
+    // combinations of gradients that at least min_share of the template's
+    // points have.  Returns false, changing nothing, for compact planes.
+    bool lean(double min_share)
+    {
+      if (m_Format == PLANES_LEAN) return true;
+      if (m_Format != PLANES_FULL || !m_Data) return false;
+      unsigned uses[PLANES] = { 0 };
+      for (const_iterator it = begin(); it != end(); ++it)
+        ++uses[it->g()];
+      byte slot[PLANES];
+      memset(slot, LEAN_COMBINE, sizeof(slot));
+      slot[LEFT] = 0;
+      slot[TOP] = 1;
+      slot[RIGHT] = 2;
+      slot[BOTTOM] = 3;
+      unsigned planes = 4;
+      for (unsigned g = 1; g < PLANES; ++g)
+        if (slot[g] == LEAN_COMBINE && uses[g] > 0 && uses[g] >= min_share * m_PointCount)
+          slot[g] = byte(planes++);
+      AlignedBuffer block(block_size(m_PointCount, PLANES_LEAN, planes));
+      memset(block.data(), 0, LEAN_HEADER);
+      memcpy(block.data(), slot, PLANES);
+      block.data()[PLANES] = byte(planes);
+      unsigned short* dist = reinterpret_cast<unsigned short*>(block.data() + LEAN_HEADER);
+      byte* nx = block.data() + LEAN_HEADER + planes * PLANE_SIZE * sizeof(unsigned short);
+      byte* ny = nx + planes * PLANE_SIZE;
+      for (unsigned g = 0; g < PLANES; ++g)
+      {
+        if (slot[g] == LEAN_COMBINE) continue;
+        memcpy(dist + slot[g] * PLANE_SIZE, dist_plane(g), PLANE_SIZE * sizeof(unsigned short));
+        memcpy(nx + slot[g] * PLANE_SIZE, near_x_plane(g), PLANE_SIZE);
+        memcpy(ny + slot[g] * PLANE_SIZE, near_y_plane(g), PLANE_SIZE);
+      }
+      memcpy(block.data() + planes_bytes(PLANES_LEAN, planes), offsets(),
+             m_PointCount * (sizeof(unsigned short) + sizeof(PerimeterPixel)));
+      memset(block.data() + block_size(m_PointCount, PLANES_LEAN, planes) - GATHER_SLACK, 0, GATHER_SLACK);
+      m_Block.swap(block);
+      m_Data = m_Block.data();
+      m_Size = block_size(m_PointCount, PLANES_LEAN, planes);
+      m_Mapping.reset();
+      m_Format = PLANES_LEAN;
+      m_Planes = planes;
+      return true;
+    }
+
+    // image must be an N x N binary (0 / 255) glyph
+    void build_matrices(const cv::Mat& image, DistanceTransform method = DT_EXACT)
+    {
+      uint32_t rows[N];
+      pack_glyph(image, N, rows);
+      build_matrices(rows, method);
+    }
+
+    // rows is the glyph packed by pack_glyph
+    void build_matrices(const uint32_t* rows, DistanceTransform method = DT_EXACT)
+    {
+      build_points(rows);
+      build_planes(method);
+    }
+
+    // First half of build_matrices: the perimeter points, their offsets and
+    // the descriptor, enough to match these points against the planes of
+    // another perimeter.  The planes stay unset until build_planes.  The
+    // boundary pixels facing each direction come from whole row shifts,
+    // pixels outside the glyph count as white.  Points are stored with a
+    // stride of 4 in the row major order, so the first quarter and the
+    // first half of them are even subsamples of the outline.
+    void build_points(const uint32_t* rows)
+    {
+      PerimeterPixel points[PLANE_SIZE];
+      unsigned n = 0;
+      for (int y = 0; y < N; ++y)
+      {
+        uint32_t row = rows[y];
+        uint32_t left = row & ~(row << 1);
+        uint32_t right = row & ~(row >> 1);
+        uint32_t top = row & ~(y == 0 ? 0 : rows[y - 1]);
+        uint32_t bottom = row & ~(y == (N - 1) ? 0 : rows[y + 1]);
+        for (uint32_t edge = left | right | top | bottom; edge; edge &= edge - 1)
+        {
+          unsigned x = lowest_bit(edge);
+          uint32_t bit = uint32_t(1) << x;
+          PerimeterPixel& pp = points[n++];
+          pp = PerimeterPixel(x, y);
+          if (left & bit) pp.add_grad(LEFT);
+          if (right & bit) pp.add_grad(RIGHT);
+          if (top & bit) pp.add_grad(TOP);
+          if (bottom & bit) pp.add_grad(BOTTOM);
+        }
+      }
+      reserve(n);
+      m_Data = m_Block.data();
+      m_Size = block_size(n);
+      m_Mapping.reset();
+      m_PointCount = n;
+      m_Format = PLANES_FULL;
+      m_Planes = PLANES;
+      static const unsigned phases[4] = { 0, 2, 1, 3 };
+      PerimeterPixel* stored = points_data();
+      for (unsigned phase : phases)
+        for (unsigned i = phase; i < n; i += 4)
+          *stored++ = points[i];
+      stored = points_data();
+      unsigned short* offsets = offsets_data();
+      for (unsigned i = 0; i < n; ++i)
+        offsets[i] = stored[i].g()*PLANE_SIZE + stored[i].y()*N + stored[i].x();
+      // Saved with the block, keep model files reproducible
+      memset(m_Block.data() + m_Size - GATHER_SLACK, 0, GATHER_SLACK);
+      m_Descriptor.compute(points, points + n, N);
+    }
+
+    // Second half of build_matrices: the distance planes of the points
+    void build_planes(DistanceTransform method = DT_EXACT)
+    {
+      static const unsigned base_plane[4] = { LEFT, TOP, RIGHT, BOTTOM };
+      cell_mat base[4];
+      for (int i = 0; i < 4; ++i) base[i].fill(Cell());
+      for (const_iterator it = begin(); it != end(); ++it)
+        for (int i = 0; i < 4; ++i)
+          if (it->g() & base_plane[i]) (base[i])(it->x(), it->y()).set(0);
+      finalize_matrices(base, method);
+    }
+
+    // Summary used to skip templates before matching.  The aspect ratio of
+    // the glyph before normalization is not known here, owners set it.
+    const GlyphDescriptor& descriptor() const { return m_Descriptor; }
+    void set_aspect(float aspect) { m_Descriptor.aspect = aspect; }
+
+    typedef const PerimeterPixel* const_iterator;
+    const_iterator begin() const
+    {
+      if (!m_Data) return nullptr;
+      return reinterpret_cast<const PerimeterPixel*>(offsets() + m_PointCount);
+    }
+    const_iterator end()   const { return begin() + m_PointCount; }
+    unsigned point_count() const { return m_PointCount; }
+
+    const unsigned short* dist_plane(unsigned g) const { return reinterpret_cast<const unsigned short*>(m_Data) + g*PLANE_SIZE; }
+    const byte* near_x_plane(unsigned g) const { return m_Data + DIST_BYTES + g*PLANE_SIZE; }
+    const byte* near_y_plane(unsigned g) const { return m_Data + DIST_BYTES + NEAR_BYTES + g*PLANE_SIZE; }
+    const unsigned short* offsets() const
+    {
+      if (!m_Data) return nullptr;
+      return reinterpret_cast<const unsigned short*>(m_Data + planes_bytes(m_Format, m_Planes));
+    }
+
+    // Sum of squared distances of p's points from this perimeter.
+    // The sum never decreases while accumulating, so once it exceeds bound
+    // the kernel may stop and return any value greater than bound.
+    unsigned match(const Perimeter& p, unsigned thres, unsigned bound = UINT_MAX,
+                   match_kernel kernel = nullptr, unsigned dest_thres = DEST_THRES) const
+    {
+      return match_prefix(p, p.point_count(), thres, bound, kernel, dest_thres);
+    }
+
+    // Same as match over the first points of p only, an even subsample of
+    // its outline when points is a quarter or a half of them
+    unsigned match_prefix(const Perimeter& p, unsigned points, unsigned thres, unsigned bound = UINT_MAX,
+                          match_kernel kernel = nullptr, unsigned dest_thres = DEST_THRES) const
+    {
+      if (!kernel) kernel = select_match_kernel();
+      MatchPlanes planes = { nullptr, nullptr, nullptr, N, m_Format, nullptr, nullptr, nullptr };
+      if (m_Format == PLANES_LEAN)
+        planes = lean_planes();
+      else
+      if (m_Format == PLANES_COMPACT)
+      {
+        planes.dist8 = m_Data;
+        planes.near_index = m_Data + NEAR_BYTES;
+      }
+      else
+      {
+        planes.dist = dist_plane(0);
+        planes.near_x = near_x_plane(0);
+        planes.near_y = near_y_plane(0);
+      }
+      return kernel(planes, p.offsets(), std::min(points, p.point_count()), thres, dest_thres, bound);
+    }
+  };
+
+  template<int N>
+  inline double score_from_distance(unsigned total)
+  {
+    const double mult = sqr(1.0 / N);
+    double m = 0.5*total*mult;
+    return exp(-m);
+  }
+
+  template<int N>
+  double match(const Perimeter<N>& a, const Perimeter<N>& b, unsigned thres)
+  {
+    unsigned ma = a.match(b, thres);
+    unsigned mb = b.match(a, thres);
+    return score_from_distance<N>(ma + mb);
+  }
+
+  // Symmetric distance between query q and template t, or some value
+  // greater than bound if it is known to exceed it.  The forward half
+  // (query points on the template's matrices) is computed first, and the
+  // reverse half is skipped when the forward half alone exceeds bound.
+  template<int N>
+  unsigned bounded_distance(const Perimeter<N>& q, const Perimeter<N>& t, unsigned thres, unsigned bound,
+                            match_kernel kernel, unsigned dest_thres = DEST_THRES)
+  {
+    unsigned forward = t.match(q, thres, bound, kernel, dest_thres);
+    if (forward > bound) return forward;
+    return forward + q.match(t, thres, bound - forward, kernel, dest_thres);
+  }
+
+} // namespace OpticMatch
+
+#endif // H_PERIMETER_OPTMATCH
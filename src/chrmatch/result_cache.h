@@ -0,0 +1,160 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+#ifndef H_RESULT_CACHE_OPTMATCH
+#define H_RESULT_CACHE_OPTMATCH
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include "bitmap.h"
+
+namespace OpticMatch {
+
+  // Bounded cache of classify results, keyed by the packed normalized glyph,
+  // its aspect and the generation of the model that classified it, so
+  // results of replaced models are never returned.  Nothing is cleared when
+  // the model changes: entries of older generations are no longer looked
+  // up, age out as the least recently used and count as evictions when
+  // replaced.  Set associative: a glyph can only be in the WAYS entries of
+  // the set its hash selects, replacing the least recently used one.  Each set has its own lock, and all entries are allocated up front
+  // so lookups and inserts never allocate.
+  template<int N>
+  class ResultCache
+  {
+  public:
+    enum { WAYS = 4 };
+
+    std::atomic<unsigned long> hits;
+    std::atomic<unsigned long> misses;
+    std::atomic<unsigned long> evictions;  // Entries replaced by a different glyph or generation
+
+    // Rounds capacity up to a multiple of WAYS, 0 disables the cache
+    explicit ResultCache(size_t capacity)
+      : hits(0)
+      , misses(0)
+      , evictions(0)
+      , m_SetCount((capacity + WAYS - 1) / WAYS)
+      , m_Sets(m_SetCount > 0 ? new Set[m_SetCount] : nullptr)
+    {}
+
+    bool   enabled() const { return m_SetCount > 0; }
+    size_t capacity() const { return m_SetCount * WAYS; }
+
+    bool lookup(const uint32_t* rows, float aspect, uint64_t generation, wchar_t& ch, double& conf)
+    {
+      uint64_t h = key_hash(rows, aspect, generation);
+      Set& s = m_Sets[h % m_SetCount];
+      std::lock_guard<std::mutex> lock(s.lock);
+      for (Entry& e : s.entries)
+        if (e.valid && e.matches(h, rows, aspect, generation))
+        {
+          e.used = ++s.tick;
+          ch = e.ch;
+          conf = e.conf;
+          ++hits;
+          return true;
+        }
+      ++misses;
+      return false;
+    }
+
+    void insert(const uint32_t* rows, float aspect, uint64_t generation, wchar_t ch, double conf)
+    {
+      uint64_t h = key_hash(rows, aspect, generation);
+      Set& s = m_Sets[h % m_SetCount];
+      std::lock_guard<std::mutex> lock(s.lock);
+      Entry* victim = &s.entries[0];
+      for (Entry& e : s.entries)
+      {
+        // Another thread may have classified the same glyph meanwhile
+        if (e.valid && e.matches(h, rows, aspect, generation)) return;
+        if (!e.valid || (victim->valid && e.used < victim->used)) victim = &e;
+      }
+      if (victim->valid) ++evictions;
+      victim->valid = true;
+      victim->hash = h;
+      victim->aspect = aspect;
+      victim->generation = generation;
+      memcpy(victim->rows, rows, sizeof(victim->rows));
+      victim->ch = ch;
+      victim->conf = conf;
+      victim->used = ++s.tick;
+    }
+
+    void reset_counters()
+    {
+      hits = 0;
+      misses = 0;
+      evictions = 0;
+    }
+
+  private:
+    struct Entry
+    {
+      bool     valid;
+      uint64_t hash;
+      uint64_t used;  // Set tick of the last lookup or insert
+      uint64_t generation;
+      float    aspect;
+      uint32_t rows[N];
+      wchar_t  ch;
+      double   conf;
+
+      Entry() : valid(false), hash(0), used(0), generation(0), aspect(0), ch(0), conf(0) {}
+
+      bool matches(uint64_t h, const uint32_t* r, float a, uint64_t g) const
+      {
+        return hash == h && generation == g && aspect == a && memcmp(rows, r, sizeof(rows)) == 0;
+      }
+    };
+
+    struct Set
+    {
+      std::mutex lock;
+      uint64_t   tick;
+      Entry      entries[WAYS];
+
+      Set() : tick(0) {}
+    };
+
+    size_t                 m_SetCount;
+    std::unique_ptr<Set[]> m_Sets;
+
+    static uint64_t key_hash(const uint32_t* rows, float aspect, uint64_t generation)
+    {
+      uint32_t a;
+      memcpy(&a, &aspect, sizeof(a));
+      uint64_t h = hash_rows(rows, N) ^ a ^ (generation * 0x9E3779B97F4A7C15ULL);
+      // Mix the high bits in, the set index only takes the low ones
+      return h ^ (h >> 29) ^ (h >> 47);
+    }
+  };
+
+} // namespace OpticMatch
+
+#endif // H_RESULT_CACHE_OPTMATCH
@@ -30,6 +30,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <fstream>
 #include <algorithm>
 #include <numeric>
+#include <climits>
+#include <cstdio>
+#include <unordered_map>
+#include <chrono>
+#include <mutex>
 #include <optmatch/optmatch.h>
 
 #endif // H_STDAFX
@@ -0,0 +1,149 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+#ifndef H_VPTREE_OPTMATCH
+#define H_VPTREE_OPTMATCH
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <cmath>
+#include <climits>
+#include <cstdint>
+
+namespace OpticMatch {
+
+  // Vantage point tree over items [0,count) of a symmetric distance.  Each
+  // node splits the items below it at the median distance from its item.
+  // Radii and bounds are kept on the square root of the distance: the match
+  // distance sums squared pixel offsets, so its root is much closer to a
+  // metric and the triangle inequality bounds rarely cut off the nearest item.
+  class VpTree
+  {
+  public:
+    struct Node
+    {
+      size_t item;
+      float  radius;   // Items inside are at most radius from item, outside at least
+      int    inside;   // Child node indices, -1 if none
+      int    outside;
+    };
+
+    // Nodes waiting to be searched, with their lower bounds
+    typedef std::vector<std::pair<float, int>> frontier;
+
+    bool   empty() const { return m_Nodes.empty(); }
+    size_t size() const { return m_Nodes.size(); }
+    void   clear() { m_Nodes.clear(); }
+
+    // dist(a, b) returns the distance between items a and b
+    template<class DIST>
+    void build(size_t count, DIST dist)
+    {
+      m_Nodes.clear();
+      m_Nodes.reserve(count);
+      std::vector<std::pair<unsigned, size_t>> items(count);
+      for (size_t i = 0; i < count; ++i)
+        items[i] = std::make_pair(0U, i);
+      build(items.data(), items.data() + count, dist);
+    }
+
+    // dist_to(item) returns the query's distance to item.  Returns the
+    // nearest item, ties going to the higher item, or SIZE_MAX if none is
+    // within best, which is lowered to its distance.  A nonzero budget stops
+    // the search after that many nodes, the result is then approximate.
+    // visited receives the number of nodes whose item was compared.
+    template<class DIST>
+    size_t search(DIST dist_to, unsigned& best, size_t budget, frontier& open, size_t* visited = nullptr) const
+    {
+      size_t result = SIZE_MAX, n = 0;
+      open.clear();
+      if (!m_Nodes.empty()) open.push_back(std::make_pair(0.0f, 0));
+      auto closer = [](const std::pair<float, int>& a, const std::pair<float, int>& b) { return a.first > b.first; };
+      while (!open.empty() && (budget == 0 || n < budget))
+      {
+        std::pop_heap(open.begin(), open.end(), closer);
+        std::pair<float, int> top = open.back();
+        open.pop_back();
+        if (best != UINT_MAX && top.first > root_of(best)) break;
+        const Node& node = m_Nodes[top.second];
+        ++n;
+        unsigned d = dist_to(node.item);
+        if (d < best || (d == best && (result == SIZE_MAX || node.item > result)))
+        {
+          best = d;
+          result = node.item;
+        }
+        float q = float(std::sqrt(double(d)));
+        if (node.inside >= 0)
+        {
+          open.push_back(std::make_pair(std::max(top.first, q - node.radius), node.inside));
+          std::push_heap(open.begin(), open.end(), closer);
+        }
+        if (node.outside >= 0)
+        {
+          open.push_back(std::make_pair(std::max(top.first, node.radius - q), node.outside));
+          std::push_heap(open.begin(), open.end(), closer);
+        }
+      }
+      if (visited) *visited = n;
+      return result;
+    }
+
+  private:
+    std::vector<Node> m_Nodes;
+
+    // Slightly above the root, so rounding never prunes a tie
+    static float root_of(unsigned d)
+    {
+      return float(std::sqrt(double(d)) * (1 + 1e-5) + 1e-5);
+    }
+
+    template<class DIST>
+    int build(std::pair<unsigned, size_t>* b, std::pair<unsigned, size_t>* e, DIST dist)
+    {
+      if (b == e) return -1;
+      int index = int(m_Nodes.size());
+      Node node = { b->second, 0.0f, -1, -1 };
+      m_Nodes.push_back(node);
+      std::pair<unsigned, size_t>* rest = b + 1;
+      if (rest == e) return index;
+      for (auto* it = rest; it != e; ++it)
+        it->first = dist(node.item, it->second);
+      std::pair<unsigned, size_t>* mid = rest + (e - rest - 1) / 2;
+      std::nth_element(rest, mid, e);
+      float radius = float(std::sqrt(double(mid->first)));
+      int inside = build(rest, mid + 1, dist);
+      int outside = build(mid + 1, e, dist);
+      m_Nodes[index].radius = radius;
+      m_Nodes[index].inside = inside;
+      m_Nodes[index].outside = outside;
+      return index;
+    }
+  };
+
+} // namespace OpticMatch
+
+#endif // H_VPTREE_OPTMATCH
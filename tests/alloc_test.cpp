@@ -0,0 +1,108 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+// Steady state classification must not touch the heap.  Every operator new
+// is counted while queries not seen before are classified on a warmed up
+// context, then again on the thread's own context and through classify_topk
+// and classify_scores, for the configurations with per query scratch state.
+// The library's containers, shared pointers and contexts all allocate
+// through operator new.
+#include <optmatch/optmatch.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include "glyphs.h"
+
+static std::atomic<unsigned long> g_Allocations(0);
+
+void* operator new(size_t size)
+{
+  ++g_Allocations;
+  void* p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+
+using namespace OpticMatch;
+
+static unsigned long run_queries(const CharClassifier& cls, ClassifyContext& ctx,
+                                 const std::vector<cv::Mat>& queries)
+{
+  ClassScore top[5];
+  float scores[64];
+  wchar_t chars[64];
+  unsigned long before = g_Allocations;
+  for (const cv::Mat& q : queries)
+  {
+    double conf;
+    cls.classify(q, ctx, &conf);
+    cls.classify(q, &conf);
+    cls.classify_topk(q, 5, top);
+    cls.classify_scores(q, scores, 64, chars);
+  }
+  return g_Allocations - before;
+}
+
+int main()
+{
+  const wchar_t CLASSES = 20;
+  std::vector<cv::Mat> images;
+  std::vector<wchar_t> chars;
+  make_training_set(CLASSES, 12, images, chars);
+  std::vector<cv::Mat> warmup = make_queries(CLASSES, 40, 0);
+  std::vector<cv::Mat> queries = make_queries(CLASSES, 40, 1);
+
+  const char* configs[] =
+  {
+    "",
+    "<classifier cache=\"64\"/>",
+    "<classifier interleave=\"1\"/>",
+    "<classifier coarse_margin=\"2\"/>",
+    "<classifier coarse_margin=\"2\" cache=\"64\" interleave=\"1\"/>",
+    "<classifier lazy=\"1\" lazy_candidates=\"8\"/>",
+    "<classifier vptree=\"1\" vptree_budget=\"16\"/>",
+    "<classifier prefilter=\"0.6\" pixel_prefilter=\"0.3\"/>"
+  };
+  int failures = 0;
+  for (const char* config : configs)
+  {
+    std::shared_ptr<CharClassifier> cls = CharClassifier::create(config);
+    cls->add_training_samples(images.data(), chars.data(), images.size(), 1);
+    std::shared_ptr<ClassifyContext> ctx = cls->create_context();
+    run_queries(*cls, *ctx, warmup);
+    unsigned long misses = run_queries(*cls, *ctx, queries);
+    unsigned long hits = run_queries(*cls, *ctx, queries);
+    printf("%-60s allocations: %lu new queries, %lu repeated\n", config[0] ? config : "(defaults)", misses, hits);
+    if (misses != 0 || hits != 0) ++failures;
+  }
+  if (failures) printf("FAILED: %d configurations allocate\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,79 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+// coarse_margin="0" disables the coarse pass and must classify exactly as
+// the reference engine, char and confidence, as must a margin so large
+// that every template gets the full match.  Smaller margins are
+// approximate; the share of results they change is printed, not checked.
+#include <optmatch/optmatch.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "glyphs.h"
+
+using namespace OpticMatch;
+
+int main()
+{
+  const wchar_t CLASSES = 20;
+  std::vector<cv::Mat> images;
+  std::vector<wchar_t> chars;
+  make_training_set(CLASSES, 12, images, chars);
+  std::vector<cv::Mat> queries = make_queries(CLASSES, 300);
+
+  struct Case { const char* size; const char* margin; bool exact; } cases[] =
+  {
+    { "24", "0", true },
+    { "16", "0", true },
+    { "32", "0", true },
+    { "24", "65535", true },
+    { "24", "2", false },
+    { "24", "8", false },
+    { "24", "16", false }
+  };
+  int failures = 0;
+  for (const Case& c : cases)
+  {
+    std::string size = std::string("size=\"") + c.size + "\"";
+    std::shared_ptr<CharClassifier> ref = CharClassifier::create("<classifier " + size + " engine=\"reference\"/>");
+    std::string config = "<classifier " + size + " coarse_margin=\"" + c.margin + "\"/>";
+    std::shared_ptr<CharClassifier> cls = CharClassifier::create(config);
+    ref->add_training_samples(images.data(), chars.data(), images.size());
+    cls->add_training_samples(images.data(), chars.data(), images.size());
+    int differing = 0;
+    for (const cv::Mat& q : queries)
+    {
+      double ref_conf, conf;
+      wchar_t ref_char = ref->classify(q, &ref_conf);
+      wchar_t ch = cls->classify(q, &conf);
+      if (ch != ref_char || conf != ref_conf) ++differing;
+    }
+    printf("%-45s %3d of %d queries differ from the reference engine\n", config.c_str(), differing,
+           int(queries.size()));
+    if (c.exact && differing) ++failures;
+  }
+  if (failures) printf("FAILED: %d configurations\n", failures);
+  return failures ? 1 : 0;
+}
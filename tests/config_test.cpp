@@ -0,0 +1,79 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+// CharClassifier::create must reject malformed, negative and out of range
+// numbers with invalid_parameters_exception, like unknown names, and
+// accept the values at the ends of each range.
+#include <optmatch/optmatch.h>
+#include <cstdio>
+#include <string>
+
+using namespace OpticMatch;
+
+static int g_Failures = 0;
+
+static void expect(const std::string& attributes, bool valid)
+{
+  std::string params = "<classifier " + attributes + "/>";
+  bool threw = false;
+  try
+  {
+    CharClassifier::create(params);
+  }
+  catch (const invalid_parameters_exception&)
+  {
+    threw = true;
+  }
+  if (threw == valid)
+  {
+    ++g_Failures;
+    printf("FAILED: %s was %s\n", params.c_str(), valid ? "rejected" : "accepted");
+  }
+}
+
+int main()
+{
+  const char* valid[] =
+  {
+    "size=\"16\"", "threads=\"0\"", "threads=\"1024\"", "thres=\"0\"", "thres=\"65535\"",
+    "dest_thres=\"255\"", "prefilter=\"0\"", "prefilter=\"1\"", "pixel_prefilter=\"0.25\"",
+    "lean_share=\"1\"", "interleave=\"1\"", "vptree=\"0\"", "vptree_budget=\"4294967295\"",
+    "cache=\"16777216\"", "lazy_candidates=\"8\"", "coarse_margin=\"1.5\"", "thres=\" 4\""
+  };
+  const char* invalid[] =
+  {
+    "size=\"20\"", "size=\"abc\"", "threads=\"-1\"", "threads=\"1025\"", "thres=\"-1\"",
+    "thres=\"4294967295\"", "thres=\"4x\"", "thres=\"\"", "dest_thres=\"256\"",
+    "prefilter=\"-0.1\"", "prefilter=\"1.5\"", "prefilter=\"nan\"", "pixel_prefilter=\"2\"",
+    "lean_share=\"inf\"", "interleave=\"2\"", "lazy=\"yes\"", "vptree_budget=\"4294967296\"",
+    "cache=\"16777217\"", "lazy_candidates=\"abc\"", "coarse_margin=\"-2\"", "engine=\"fast\"",
+    "planes=\"compact\" thres=\"255\""
+  };
+  for (const char* a : valid) expect(a, true);
+  for (const char* a : invalid) expect(a, false);
+  printf("%d of %d parameter checks failed\n", g_Failures,
+         int(sizeof(valid) / sizeof(valid[0]) + sizeof(invalid) / sizeof(invalid[0])));
+  return g_Failures ? 1 : 0;
+}
@@ -0,0 +1,77 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+#ifndef H_TEST_GLYPHS_OPTMATCH
+#define H_TEST_GLYPHS_OPTMATCH
+
+// Synthetic glyphs for the tests, so they run without fonts
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// A white w x h image with a few black bars, the same for the same seed
+inline cv::Mat make_glyph(unsigned seed, int w, int h)
+{
+  std::mt19937 rng(seed);
+  cv::Mat image(h, w, CV_8UC1);
+  for (int y = 0; y < h; ++y)
+    memset(image.data + y * image.step, 255, w);
+  for (int k = 0; k < 5; ++k)
+  {
+    int x0 = int(rng() % (w - 4)), y0 = int(rng() % (h - 4));
+    int x1 = std::min(w, x0 + 2 + int(rng() % (w / 3)));
+    int y1 = std::min(h, y0 + 2 + int(rng() % (h / 3)));
+    for (int y = y0; y < y1; ++y)
+      memset(image.data + y * image.step + x0, 0, x1 - x0);
+  }
+  return image;
+}
+
+// samples glyphs of each of classes characters from L'a', drawn from four
+// shapes per class at varying sizes
+inline void make_training_set(wchar_t classes, unsigned samples,
+                              std::vector<cv::Mat>& images, std::vector<wchar_t>& chars)
+{
+  for (wchar_t c = 0; c < classes; ++c)
+    for (unsigned i = 0; i < samples; ++i)
+    {
+      images.push_back(make_glyph(c * 1000 + i % 4, 30 + int(i), 36 + int(i)));
+      chars.push_back(L'a' + c);
+    }
+}
+
+// count glyphs of the training shapes at sizes not trained on
+inline std::vector<cv::Mat> make_queries(wchar_t classes, unsigned count, unsigned seed = 0)
+{
+  std::vector<cv::Mat> queries;
+  for (unsigned i = 0; i < count; ++i)
+    queries.push_back(make_glyph(i % classes * 1000 + (i + seed) % 4, 27 + int((i + seed) % 15), 29 + int(i % 11)));
+  return queries;
+}
+
+#endif // H_TEST_GLYPHS_OPTMATCH
@@ -0,0 +1,159 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+// Every match and block kernel the CPU supports must give the scalar
+// kernel's results bit for bit.  Random glyphs at each grid size are
+// matched in full, compact and lean formats over a range of thresholds,
+// including ones from 2^31 up, with and without a bound.  A bounded match
+// must return the exact distance when it is within the bound and some
+// value above the bound otherwise.  Interleaved block sums must equal the
+// scalar ones and stay lower bounds of the forward distances.
+#include <optmatch/optmatch.h>
+#include <perimeter.h>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "glyphs.h"
+
+using namespace OpticMatch;
+
+static unsigned long g_Checks = 0, g_Failures = 0;
+
+static void check(bool ok, const char* what, int n, KernelVariant v, unsigned thres)
+{
+  ++g_Checks;
+  if (ok) return;
+  if (++g_Failures <= 20)
+    printf("FAILED: %s, N=%d kernel %s thres %u\n", what, n, kernel_variant_name(v), thres);
+}
+
+template<int N>
+static void test_grid(std::mt19937& rng)
+{
+  typedef Perimeter<N> perimeter;
+  std::vector<perimeter> queries, templates;
+  for (int i = 0; i < 48; ++i)
+  {
+    uint32_t rows[N];
+    if (i % 4 == 3)
+    {
+      // Scattered pixels, many points and many gradient combinations
+      for (int y = 0; y < N; ++y)
+        rows[y] = uint32_t(rng() & rng()) & uint32_t((uint64_t(1) << N) - 1);
+    }
+    else
+    {
+      cv::Mat image = make_glyph(unsigned(rng()), 20 + int(rng() % 60), 20 + int(rng() % 60));
+      normalize_glyph(image, glyph_bounds(image), N, rows);
+    }
+    perimeter p(rows);
+    if (p.point_count() == 0) continue;
+    queries.push_back(p);
+    templates.push_back(p);
+    perimeter c(p);
+    if (c.compact()) templates.push_back(c);
+    perimeter lean(p);
+    lean.lean(0.1);
+    templates.push_back(lean);
+    perimeter base(p);
+    base.lean(1.1);  // Base direction planes only
+    templates.push_back(base);
+  }
+
+  std::vector<KernelVariant> variants;
+  for (int v = KERNEL_SCALAR; v <= supported_kernel_variant(); ++v)
+    variants.push_back(KernelVariant(v));
+
+  const unsigned thresholds[] = { 0, 4, 100, 255, 70000, 0x80000000U, UINT_MAX - 1 };
+  const unsigned dest_thresholds[] = { 0, 4, 255 };
+  for (int pair = 0; pair < 300; ++pair)
+  {
+    const perimeter& t = templates[rng() % templates.size()];
+    const perimeter& q = queries[rng() % queries.size()];
+    unsigned prefix = q.point_count() / 4;
+    for (unsigned thres : thresholds)
+      for (unsigned dest_thres : dest_thresholds)
+      {
+        unsigned exact = t.match(q, thres, UINT_MAX, match_kernel_scalar, dest_thres);
+        unsigned exact_prefix = t.match_prefix(q, prefix, thres, UINT_MAX, match_kernel_scalar, dest_thres);
+        for (KernelVariant v : variants)
+        {
+          match_kernel kernel = select_match_kernel(v);
+          check(t.match(q, thres, UINT_MAX, kernel, dest_thres) == exact, "match", N, v, thres);
+          check(t.match_prefix(q, prefix, thres, UINT_MAX, kernel, dest_thres) == exact_prefix,
+                "match_prefix", N, v, thres);
+          const unsigned bounds[] = { 0, exact / 2, exact > 0 ? exact - 1 : 0, exact };
+          for (unsigned bound : bounds)
+          {
+            unsigned d = t.match(q, thres, bound, kernel, dest_thres);
+            check(exact <= bound ? d == exact : d > bound, "bounded match", N, v, thres);
+          }
+        }
+      }
+  }
+
+  // Blocks of BLOCK_WIDTH templates, as OpticMatchTemplateSet interleaves them
+  const size_t block_bytes = perimeter::PLANES * perimeter::PLANE_SIZE * BLOCK_WIDTH;
+  AlignedBuffer block(block_bytes);
+  for (size_t first = 0; first + BLOCK_WIDTH <= templates.size(); first += BLOCK_WIDTH)
+  {
+    for (unsigned o = 0; o < perimeter::PLANES * perimeter::PLANE_SIZE; ++o)
+      for (unsigned t = 0; t < BLOCK_WIDTH; ++t)
+        block.data()[o * BLOCK_WIDTH + t] = byte(std::min(templates[first + t].distance_at(o), 255U));
+    for (int k = 0; k < 8; ++k)
+    {
+      const perimeter& q = queries[rng() % queries.size()];
+      for (unsigned thres : { 0U, 4U, 100U, 254U, 255U })
+      {
+        unsigned exact[BLOCK_WIDTH] = { 0 };
+        block_kernel_scalar(block.data(), q.offsets(), q.point_count(), thres, exact);
+        for (unsigned t = 0; t < BLOCK_WIDTH; ++t)
+          check(exact[t] <= templates[first + t].match(q, thres, UINT_MAX, match_kernel_scalar),
+                "block lower bound", N, KERNEL_SCALAR, thres);
+        for (KernelVariant v : variants)
+        {
+          unsigned sums[BLOCK_WIDTH];
+          for (unsigned t = 0; t < BLOCK_WIDTH; ++t) sums[t] = t;
+          select_block_kernel(v)(block.data(), q.offsets(), q.point_count(), thres, sums);
+          bool same = true;
+          for (unsigned t = 0; t < BLOCK_WIDTH; ++t)
+            same = same && sums[t] == exact[t] + t;
+          check(same, "block sums", N, v, thres);
+        }
+      }
+    }
+  }
+}
+
+int main()
+{
+  std::mt19937 rng(42);
+  printf("Kernels up to %s\n", kernel_variant_name(supported_kernel_variant()));
+  test_grid<16>(rng);
+  test_grid<24>(rng);
+  test_grid<32>(rng);
+  printf("%lu of %lu checks failed\n", g_Failures, g_Checks);
+  return g_Failures ? 1 : 0;
+}
@@ -0,0 +1,243 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+// Saved models must load back to the same results in every plane format
+// and with interleaving: as saved, converted to another format while
+// loading from the mapped file, and saved again over the file they are
+// mapped from.  Truncated and corrupt files must throw
+// general_message_exception, never crash, and a corrupt file that still
+// loads must classify without crashing.
+#include <optmatch/optmatch.h>
+#include <model_file.h>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <vector>
+#include "glyphs.h"
+
+using namespace OpticMatch;
+
+static const char* PATH = "model_file_test.bin";
+static const char* DAMAGED = "model_file_test_damaged.bin";
+static int g_Failures = 0;
+
+static void fail(const std::string& what)
+{
+  if (++g_Failures <= 20) printf("FAILED: %s\n", what.c_str());
+}
+
+static std::vector<char> read_file(const char* path)
+{
+  std::ifstream fin(path, std::ios::binary);
+  return std::vector<char>(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+}
+
+static void write_file(const char* path, const std::vector<char>& data, size_t size)
+{
+  std::ofstream fout(path, std::ios::binary | std::ios::trunc);
+  fout.write(data.data(), std::streamsize(size));
+}
+
+struct Results
+{
+  std::vector<wchar_t> chars;
+  std::vector<double>  confs;
+  unsigned long        templates, samples;
+
+  bool operator== (const Results& o) const
+  {
+    return chars == o.chars && confs == o.confs && templates == o.templates && samples == o.samples;
+  }
+};
+
+static Results classify_all(const CharClassifier& cls, const std::vector<cv::Mat>& queries)
+{
+  Results r;
+  for (const cv::Mat& q : queries)
+  {
+    double conf;
+    r.chars.push_back(cls.classify(q, &conf));
+    r.confs.push_back(conf);
+  }
+  ClassifierStats stats = cls.get_stats();
+  r.templates = stats.templates;
+  r.samples = stats.training_samples;
+  return r;
+}
+
+static std::shared_ptr<CharClassifier> trained(const std::string& config, const std::vector<cv::Mat>& images,
+                                               const std::vector<wchar_t>& chars)
+{
+  std::shared_ptr<CharClassifier> cls = CharClassifier::create(config);
+  cls->add_training_samples(images.data(), chars.data(), images.size());
+  return cls;
+}
+
+// Loads the damaged copy, which must throw or load into something that
+// classifies.  Returns whether it threw.
+static bool load_damaged(const std::vector<char>& data, size_t size, const std::vector<cv::Mat>& queries)
+{
+  write_file(DAMAGED, data, size);
+  std::shared_ptr<CharClassifier> cls = CharClassifier::create("");
+  try
+  {
+    cls->load(DAMAGED);
+  }
+  catch (const general_message_exception&)
+  {
+    return true;
+  }
+  classify_all(*cls, queries);
+  return false;
+}
+
+static void expect_throw(const std::vector<char>& data, size_t size, const std::vector<cv::Mat>& queries,
+                         const char* what)
+{
+  if (!load_damaged(data, size, queries)) fail(std::string(what) + " loaded");
+}
+
+template<typename T>
+static void poke(std::vector<char>& data, size_t offset, T value)
+{
+  memcpy(&data[offset], &value, sizeof(T));
+}
+
+int main()
+{
+  const wchar_t CLASSES = 12;
+  std::vector<cv::Mat> images, more;
+  std::vector<wchar_t> chars, more_chars;
+  make_training_set(CLASSES, 8, images, chars);
+  make_training_set(CLASSES + 4, 3, more, more_chars);
+  std::vector<cv::Mat> queries = make_queries(CLASSES + 4, 120);
+
+  const char* configs[] =
+  {
+    "",
+    "<classifier planes=\"compact\"/>",
+    "<classifier planes=\"lean\"/>",
+    "<classifier interleave=\"1\"/>"
+  };
+  for (const char* saved : configs)
+  {
+    std::string name = saved[0] ? saved : "(defaults)";
+    std::shared_ptr<CharClassifier> cls = trained(saved, images, chars);
+    Results expected = classify_all(*cls, queries);
+    cls->save(PATH);
+    std::shared_ptr<CharClassifier> loaded = CharClassifier::create(saved);
+    loaded->load(PATH);
+    if (!(classify_all(*loaded, queries) == expected)) fail(name + ": loaded model differs");
+
+    // Loading into another format converts the mapped blocks into owned ones
+    for (const char* other : configs)
+    {
+      if (other == saved) continue;
+      std::shared_ptr<CharClassifier> converted = CharClassifier::create(other);
+      converted->load(PATH);
+      if (!(classify_all(*converted, queries) == classify_all(*trained(other, images, chars), queries)))
+        fail(name + " loaded as " + other + " differs from training it");
+    }
+
+    // Templates still mapped from PATH are written over it
+    loaded->add_training_samples(more.data(), more_chars.data(), more.size());
+    Results grown = classify_all(*loaded, queries);
+    loaded->save(PATH);
+    std::shared_ptr<CharClassifier> reloaded = CharClassifier::create(saved);
+    reloaded->load(PATH);
+    if (!(classify_all(*reloaded, queries) == grown)) fail(name + ": model saved over its own file differs");
+    if (!(classify_all(*loaded, queries) == grown)) fail(name + ": model changed after saving over its file");
+  }
+
+  trained("", images, chars)->save(PATH);
+  const std::vector<char> file = read_file(PATH);
+  const size_t size = file.size();
+  const int N = 24;
+  for (size_t cut : { size_t(0), size_t(8), sizeof(ModelHeader) - 1, sizeof(ModelHeader) + 64, size / 2, size - 1 })
+    expect_throw(file, cut, queries, "truncated file");
+
+  ModelHeader header;
+  memcpy(&header, file.data(), sizeof(header));
+  const size_t table = size_t(header.templates_offset);
+  std::vector<char> data;
+  auto damage = [&](const char* what, size_t offset, uint64_t value, size_t bytes)
+  {
+    data = file;
+    if (bytes == 8) poke(data, offset, value);
+    else
+    if (bytes == 4) poke(data, offset, uint32_t(value));
+    else
+    if (bytes == 2) poke(data, offset, uint16_t(value));
+    else
+      poke(data, offset, uint8_t(value));
+    expect_throw(data, size, queries, what);
+  };
+  damage("bad magic", offsetof(ModelHeader, magic), 'X', 1);
+  damage("other version", offsetof(ModelHeader, version), MODEL_VERSION + 1, 4);
+  damage("other grid", offsetof(ModelHeader, grid), 16, 4);
+  damage("huge class count", offsetof(ModelHeader, class_count), 0x7FFFFFFF, 4);
+  damage("huge template count", offsetof(ModelHeader, template_count), 0xFFFFFFFF, 4);
+  damage("wrapping classes offset", offsetof(ModelHeader, classes_offset), ~uint64_t(0) - 63, 8);
+  damage("unaligned templates offset", offsetof(ModelHeader, templates_offset), table + 4, 8);
+  damage("wrong file size", offsetof(ModelHeader, file_size), size + 64, 8);
+  damage("first template past the classes", header.classes_offset + offsetof(ModelClass, first_template),
+         header.template_count, 4);
+  damage("wrapping template offset", table + offsetof(ModelTemplate, offset), ~uint64_t(0) - 63, 8);
+  damage("short template block", table + offsetof(ModelTemplate, size), 64, 4);
+  damage("too many points", table + offsetof(ModelTemplate, point_count), N * N + 1, 4);
+  damage("zero multiplicity", table + offsetof(ModelTemplate, multiplicity), 0, 4);
+  damage("unknown format", table + offsetof(ModelTemplate, format), 7, 4);
+
+  // Within the first template block, a full format one
+  ModelTemplate first;
+  memcpy(&first, &file[table], sizeof(first));
+  const size_t block = size_t(first.offset);
+  const size_t near_x = block + 16 * N * N * sizeof(unsigned short);
+  const size_t offsets = near_x + 2 * 16 * N * N;
+  const size_t points = offsets + first.point_count * sizeof(unsigned short);
+  damage("point offset outside the planes", offsets, 0xFFFF, 2);
+  damage("nearest point outside the grid", near_x + 5, 200, 1);
+  damage("point outside the grid", points, 200, 1);
+  damage("point gradient out of range", points + 2, 0xF0, 1);
+
+  // Random damage anywhere, loads or throws
+  std::mt19937 rng(7);
+  int threw = 0;
+  for (int k = 0; k < 300; ++k)
+  {
+    data = file;
+    size_t end = (k % 2 ? size : size_t(header.bitmaps_offset));
+    for (int b = 1 + int(rng() % 8); b > 0; --b)
+      data[rng() % end] = char(rng());
+    if (load_damaged(data, size, queries)) ++threw;
+  }
+  printf("%d of 300 randomly damaged files threw, the others loaded and classified\n", threw);
+
+  std::remove(PATH);
+  std::remove(DAMAGED);
+  printf("%d failures\n", g_Failures);
+  return g_Failures ? 1 : 0;
+}
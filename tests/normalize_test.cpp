@@ -0,0 +1,104 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+// Compares normalize_glyph with cv::resize (INTER_LINEAR) and
+// cv::threshold(128), the normalization of the reference engine, over
+// random glyphs of many sizes: sharp bars, grey bars and noise, whole
+// images and cropped boxes, including the exact 1x and 2x sizes.
+// Differences are counted and reported.  The test fails if a pixel
+// differs whose resized value is not within two grey levels of the
+// threshold, which rounding alone cannot explain.
+#include <optmatch/optmatch.h>
+#include <bitmap.h>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include "glyphs.h"
+
+using namespace OpticMatch;
+
+static cv::Mat random_image(std::mt19937& rng, int w, int h)
+{
+  unsigned kind = rng() % 3;
+  if (kind == 0) return make_glyph(unsigned(rng()), w, h);
+  cv::Mat image = make_glyph(unsigned(rng()), w, h);
+  for (int y = 0; y < h; ++y)
+  {
+    unsigned char* row = image.ptr(y);
+    for (int x = 0; x < w; ++x)
+      if (kind == 2)
+        row[x] = (unsigned char)(rng() % 256);
+      else
+      if (row[x] == 0)
+        row[x] = (unsigned char)(rng() % 160);
+  }
+  return image;
+}
+
+int main()
+{
+  std::mt19937 rng(1234);
+  unsigned long pixels = 0, differing = 0, failures = 0;
+  for (int n : { 16, 24, 32 })
+    for (int trial = 0; trial < 3000; ++trial)
+    {
+      int w, h;
+      switch (trial % 10)
+      {
+      case 0: w = h = n; break;
+      case 1: w = h = 2 * n; break;
+      default:
+        w = 5 + int(rng() % (4 * n));
+        h = 5 + int(rng() % (4 * n));
+      }
+      cv::Mat image = random_image(rng, w, h);
+      cv::Rect box(0, 0, w, h);
+      if (trial % 3 == 1) box = glyph_bounds(image);
+
+      uint32_t rows[32];
+      normalize_glyph(image.data, image.step, box, n, rows);
+      cv::Mat resized;
+      cv::resize(image(box), resized, cv::Size(n, n), 0, 0, cv::INTER_LINEAR);
+      cv::Mat binary;
+      cv::threshold(resized, binary, 128, 255, cv::THRESH_BINARY);
+      for (int y = 0; y < n; ++y)
+        for (int x = 0; x < n; ++x, ++pixels)
+        {
+          bool ours = (rows[y] >> x) & 1, theirs = binary.ptr(y)[x] == 0;
+          if (ours == theirs) continue;
+          ++differing;
+          int v = resized.ptr(y)[x];
+          if (v < 127 || v > 130)
+          {
+            if (++failures <= 10)
+              printf("n=%d %dx%d box %dx%d pixel (%d,%d): resized value %d, bit %d\n",
+                     n, w, h, box.width, box.height, x, y, v, int(ours));
+          }
+        }
+    }
+  printf("%lu of %lu pixels differ from cv::resize + threshold, %lu away from the threshold\n",
+         differing, pixels, failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,87 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+// classify_topk and classify_scores must agree with classify whenever
+// classify is exact: out[0] is its class with its confidence, and no class
+// scores higher in classify_scores.  Checked for the default settings and
+// for the speed options that keep classify exact.
+#include <optmatch/optmatch.h>
+#include <cstdio>
+#include <vector>
+#include "glyphs.h"
+
+using namespace OpticMatch;
+
+int main()
+{
+  const wchar_t CLASSES = 20;
+  std::vector<cv::Mat> images;
+  std::vector<wchar_t> chars;
+  make_training_set(CLASSES, 12, images, chars);
+  std::vector<cv::Mat> queries = make_queries(CLASSES, 300);
+
+  const char* configs[] =
+  {
+    "",
+    "<classifier size=\"16\"/>",
+    "<classifier size=\"32\"/>",
+    "<classifier prefilter=\"0.6\" pixel_prefilter=\"0.3\"/>",
+    "<classifier interleave=\"1\"/>",
+    "<classifier planes=\"compact\"/>",
+    "<classifier planes=\"lean\"/>",
+    "<classifier lazy=\"1\"/>",
+    "<classifier vptree=\"1\"/>",
+    "<classifier cache=\"64\"/>"
+  };
+  int failures = 0;
+  for (const char* config : configs)
+  {
+    std::shared_ptr<CharClassifier> cls = CharClassifier::create(config);
+    cls->add_training_samples(images.data(), chars.data(), images.size());
+    int differing = 0;
+    for (const cv::Mat& q : queries)
+    {
+      double conf;
+      wchar_t c = cls->classify(q, &conf);
+      ClassScore top[3];
+      size_t n = cls->classify_topk(q, 3, top);
+      float scores[CLASSES];
+      wchar_t classes[CLASSES];
+      size_t m = cls->classify_scores(q, scores, CLASSES, classes);
+      bool ok = (n > 0 && top[0].ch == c && top[0].score == conf);
+      for (size_t i = 0; i < m; ++i)
+      {
+        if (scores[i] > float(conf)) ok = false;
+        if (classes[i] == c && scores[i] != float(conf)) ok = false;
+      }
+      if (!ok) ++differing;
+    }
+    printf("%-60s %d of %d queries differ from classify\n", config[0] ? config : "(defaults)",
+           differing, int(queries.size()));
+    if (differing) ++failures;
+  }
+  if (failures) printf("FAILED: %d configurations\n", failures);
+  return failures ? 1 : 0;
+}
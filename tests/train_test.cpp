@@ -0,0 +1,134 @@
+/***************************************************************************
+Copyright (c) 2013-2015, Amir Geva
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************/
+// train must build the same model whatever the number of workers: the
+// same templates in the same order per class, checked through the saved
+// model files, and the same classify results.  More samples than one
+// training chunk are generated, classes interleaved and half of them
+// duplicates of earlier ones.
+#include <optmatch/optmatch.h>
+#include <optmatch/generator.h>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "glyphs.h"
+
+using namespace OpticMatch;
+
+static const wchar_t CLASSES = 30;
+static const unsigned SAMPLES = 36;
+
+class GlyphGenerator : public CharImageGenerator
+{
+  unsigned m_Next;
+public:
+  GlyphGenerator() : m_Next(0) {}
+
+  virtual bool generate(cv::Mat& image, wchar_t& c) override
+  {
+    if (m_Next == CLASSES * SAMPLES) return false;
+    unsigned i = m_Next / CLASSES;
+    wchar_t k = wchar_t(m_Next % CLASSES);
+    ++m_Next;
+    image = make_glyph(k * 1000 + i % 6, 28 + int(i % 9), 34 + int(i % 9));
+    c = L'a' + k;
+    return true;
+  }
+};
+
+static std::vector<char> read_file(const std::string& path)
+{
+  std::ifstream fin(path.c_str(), std::ios::binary);
+  return std::vector<char>(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+}
+
+int main()
+{
+  std::vector<cv::Mat> queries = make_queries(CLASSES, 300);
+  const char* configs[] = { "", "<classifier planes=\"compact\" interleave=\"1\"/>", "<classifier vptree=\"1\"/>" };
+  const unsigned threads[] = { 1, 2, 3, 8, 0 };
+  int failures = 0;
+  for (const char* config : configs)
+  {
+    std::vector<char> expected_file;
+    std::vector<wchar_t> expected_chars;
+    std::vector<double> expected_confs;
+    ClassifierStats expected_stats;
+    for (unsigned t : threads)
+    {
+      std::shared_ptr<CharClassifier> cls = CharClassifier::create(config);
+      GlyphGenerator gen;
+      TrainStats ts;
+      cls->train(gen, &ts, t);
+      std::string path = "train_test_" + std::to_string(t) + ".bin";
+      cls->save(path);
+      std::vector<char> file = read_file(path);
+      std::remove(path.c_str());
+      std::vector<wchar_t> chars;
+      std::vector<double> confs;
+      for (const cv::Mat& q : queries)
+      {
+        double conf;
+        chars.push_back(cls->classify(q, &conf));
+        confs.push_back(conf);
+      }
+      ClassifierStats stats = cls->get_stats();
+      std::string name = std::string(config[0] ? config : "(defaults)") + " threads=" + std::to_string(t);
+      printf("%-60s %lu samples, %lu templates\n", name.c_str(), stats.training_samples, stats.templates);
+      if (t == threads[0])
+      {
+        expected_file = file;
+        expected_chars = chars;
+        expected_confs = confs;
+        expected_stats = stats;
+        if (ts.samples != CLASSES * SAMPLES || stats.training_samples != ts.samples)
+        {
+          printf("FAILED: %s trained %zu samples\n", name.c_str(), ts.samples);
+          ++failures;
+        }
+        continue;
+      }
+      if (stats.templates != expected_stats.templates || stats.training_samples != expected_stats.training_samples)
+      {
+        printf("FAILED: %s has other template counts than threads=1\n", name.c_str());
+        ++failures;
+      }
+      if (file != expected_file)
+      {
+        printf("FAILED: %s saves another model than threads=1\n", name.c_str());
+        ++failures;
+      }
+      if (chars != expected_chars || confs != expected_confs)
+      {
+        printf("FAILED: %s classifies differently from threads=1\n", name.c_str());
+        ++failures;
+      }
+    }
+  }
+  printf("%d failures\n", failures);
+  return failures ? 1 : 0;
+}